@@ -22,44 +22,371 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <math.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#  include <immintrin.h>
+#endif
+#include "results_store.h"
+#include "self_profile.h"
 
 #define CHUNK                1024 /* read 1024 bytes at a time */
 #define IPC                  1
-#define BTB_SIZE             64
+#define BTB_SIZE             64 /* Default entries, -b changes the geometry */
+#define BTB_WAYS             1
+#define BTB_TAG_BITS         31
 #define BTB_HIT              1 
 #define BTB_MISS             5
 #define BTB_MISS_PREDICTED   4
-#define HIST_SIZE            4
-#define NUM_COUNTERS         16 /* 2**HIST_SIZE */
+#define BTB_L1_LATENCY       1  /* Extra cycles of a hit in the second level of a two-level BTB */
+#define HIST_SIZE            4  /* Default history length of two-level and perceptron */
+#define NUM_COUNTERS         16 /* Perceptron rows, 2**HIST_SIZE */
+#define MAX_PREDICTORS       8
+#define MAX_HISTORY          4096 /* Longest global history selectable with -g */
+#define MAX_PHT_HISTORY      24   /* The two-level pattern table has 2**length entries */
+
+/* TAGE: a bimodal base table and TAGE_TABLES tagged tables indexed with
+   geometric history lengths between TAGE_MIN_HISTORY and TAGE_MAX_HISTORY */
+#ifndef TAGE_TABLES
+#  define TAGE_TABLES        7
+#endif
+#ifndef TAGE_MAX_HISTORY
+#  define TAGE_MAX_HISTORY   640 /* Default, -g overrides it */
+#endif
+#define TAGE_MIN_HISTORY     4
+#define TAGE_BIMODAL_BITS    13
+#define TAGE_TABLE_BITS      10
+#define TAGE_TAG_BITS        9
+#define TAGE_PATH_BITS       16
+#define TAGE_COUNTER_MIN     (-4) /* 3-bit signed counters */
+#define TAGE_COUNTER_MAX     3
+#define TAGE_USEFUL_MAX      3
+#define TAGE_USE_ALT_MIN     (-8)
+#define TAGE_USE_ALT_MAX     7
+#define TAGE_AGING_PERIOD    (1 << 18) /* Branches between useful bit aging */
+
+/* Long history perceptron with saturating 8-bit weights, one row per
+   branch address hash. Rows are padded to the vector width */
+#define LONG_PERCEPTRON_ROWS       512
+#define LONG_PERCEPTRON_HISTORY    256
+#define LONG_PERCEPTRON_WEIGHT_MAX 127
+#if defined(__AVX2__)
+#  define LONG_PERCEPTRON_VECTOR   32
+#elif defined(__SSE4_1__)
+#  define LONG_PERCEPTRON_VECTOR   16
+#else
+#  define LONG_PERCEPTRON_VECTOR   1
+#endif
+
+/* Hashed perceptron: one weight table per feature, indexed by a hash of
+   the feature and the branch address. Features are chosen with -m */
+#define HASHED_MAX_FEATURES    16
+#define HASHED_TABLE_BITS      11 /* Default, a feature can give its own */
+#define HASHED_WEIGHT_MAX      31 /* 6-bit weights */
+#define HASHED_LOCAL_ENTRIES   1024
+#define HASHED_MAX_RECENCY     64
+#define HASHED_FEATURES        "bias,ghist:0:8,ghist:8:24,ghist:24:64,ghist:64:128,path:0:16,local:11,recency:16,loop"
+
+/* Unconditional branches: returns are predicted by a return address stack,
+   jumps and calls seen with more than one target by an ITTAGE style
+   predictor with the BTB target as its base prediction */
+#define RAS_ENTRIES            16 /* Default, -r changes it */
+#define MAX_RAS_ENTRIES        4096
+#define ITTAGE_TABLES          5
+#define ITTAGE_TABLE_BITS      9
+#define ITTAGE_TAG_BITS        10
+#define ITTAGE_MIN_HISTORY     4
+#define ITTAGE_MAX_HISTORY     64
+#define ITTAGE_CONFIDENCE_MAX  3
+
+#define BRANCH_CONDITIONAL     0
+#define BRANCH_JUMP            1
+#define BRANCH_CALL            2
+#define BRANCH_RETURN          3
+
+/* Compact traces hold only branches, converted from text traces with -c */
+#define COMPACT_MAGIC          "BTRC"
+#define COMPACT_VERSION        1
+
+#define BATCH_PATH_SIZE        4096
+#define MAX_THREADS            1024
+
+#define PROFILE_INITIAL_ENTRIES 1024 /* Power of two */
 
 #ifndef BRANCH_PREDICTOR
 #  define BRANCH_PREDICTOR   perceptron_predictor
 #endif
 
+#define BTB_LRU              0
+#define BTB_FIFO             1
+#define BTB_RANDOM           2
+
+#define BTB_VALID            0x80000000U
+
+struct btb_config {
+  unsigned int entries;
+  unsigned int ways;
+  unsigned int tag_bits;
+  unsigned int replacement;
+  unsigned int l0_entries; /* Fully associative first level, 0 for none */
+};
+
+/* Set associative BTB kept as a structure of arrays, the ways of a set are
+   contiguous so a set is matched a vector at a time. Tags are partial,
+   with BTB_VALID set on valid entries. Entry i of the optional first level
+   only holds a tag, the second level keeps targets and predictor state */
 struct branch_table {
-  unsigned long int address;
-  unsigned long int target;
-  unsigned char history; /* Two-level predictor */
-  unsigned char counter; /* Two-bit predictor */
-  int valid;
+  unsigned int sets;
+  unsigned int ways;
+  unsigned int set_bits;
+  unsigned int tag_bits;
+  unsigned int replacement;
+  unsigned int *tags;
+  unsigned long *targets;
+  unsigned char *histories; /* Two-level predictor */
+  unsigned char *counters;  /* Two-bit predictor */
+  unsigned char *indirect;  /* Seen with more than one target */
+  unsigned long *stamps;    /* Last use or insertion */
+  unsigned long clock;
+  unsigned int seed;
+  unsigned int l0_entries;
+  unsigned int *l0_tags;
+  unsigned long *l0_stamps;
+  unsigned long l0_hits;
+  unsigned long l1_hits;
+};
+
+/* Outcomes of the last conditional branches packed in a circular bit
+   buffer, the newest at position head + 1 and older ones after it, plus a
+   path history with one address bit per branch */
+struct global_history {
+  unsigned long *words;
+  unsigned int capacity; /* Bits, a power of two of at least 128 */
+  unsigned int head;
+  unsigned long path;
+};
+
+/* Circular, on overflow the oldest return address is overwritten */
+struct return_stack {
+  unsigned long *entries;
+  unsigned int size;
+  unsigned int top;
+  unsigned int depth;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long overflows;
+};
+
+struct ittage_entry {
+  unsigned long target;
+  unsigned short tag;
+  unsigned char confidence;
+  unsigned char useful;
+};
+
+/* Its history holds conditional outcomes and one bit of every indirect target */
+struct indirect_predictor {
+  struct ittage_entry *tables[ITTAGE_TABLES];
+  unsigned int history_lengths[ITTAGE_TABLES];
+  struct global_history history;
+  unsigned int seed;
+  unsigned long hits;
+  unsigned long misses;
+};
+
+/* A branch and the instruction that followed it */
+struct branch_record {
+  unsigned long address;
+  unsigned long size;
+  unsigned long next_address;
+  unsigned long run; /* Non-branch instructions since the previous branch */
+  unsigned int kind;
+};
+
+/* Each record is a kind byte followed by LEB128 varints: the run, the
+   zigzag delta of address from the previous next_address, the size and
+   the zigzag delta of next_address from the fall through address */
+struct compact_header {
+  char magic[4];
+  unsigned int version;
+  unsigned long branches;
+  unsigned long records;   /* Instructions in the text trace */
+  unsigned long tail;      /* Non-branch instructions after the last branch */
+} __attribute__((packed));
+
+/* Reads branches from a text or a compact trace */
+struct trace_reader {
+  FILE *file;
+  int compact;
+  struct compact_header header;
+  unsigned long previous;  /* next_address of the last branch */
+  unsigned long records;
+  unsigned long tail;
+  char assembly[20];       /* Text traces read one record ahead */
+  char opcode[20];
+  unsigned long address;
+  unsigned long size;
+  unsigned int is_cond;
+  int pending;
+};
+
+/* A trace of a batch run and what each predictor scored on it */
+struct batch_trace {
+  char *path;
+  unsigned long size;      /* Bytes, larger traces are started first */
+  unsigned long records;
+  unsigned long cycles[MAX_PREDICTORS];
+  unsigned long miss_pred[MAX_PREDICTORS];
+};
+
+/* Threads take the next trace in order until none is left */
+struct batch {
+  struct batch_trace *traces;
+  struct batch_trace **order;
+  unsigned int count;
+  unsigned int next;
+  const struct predictor_type **types;
+  unsigned int predictors;
+  const struct predictor_config *config;
+};
+
+/* Run time parameters shared by all predictor instances */
+struct predictor_config {
+  unsigned int history_length; /* 0 for the default of each predictor */
+  const char *features;        /* Hashed perceptron features */
+  struct btb_config btb;
+  unsigned int ras_entries;    /* 0 leaves returns to the indirect predictor */
+  unsigned int profile_top;    /* Branches reported by the profile, 0 to not profile */
+};
+
+struct branch_profile_entry {
+  unsigned long address; /* Branch address plus one, zero when the slot is empty */
+  unsigned long executions;
+  unsigned long taken;
+  unsigned long mispredictions;
+  unsigned long btb_misses;
+  unsigned long transitions; /* Outcome differs from the previous execution */
+  unsigned int last_taken;
+};
+
+/* Open addressing hash map from branch address to its counters */
+struct branch_profile {
+  struct branch_profile_entry *entries;
+  unsigned long size;
+  unsigned long used;
 };
 
-static struct branch_table btb[BTB_SIZE];
+/* Every predictor instance owns its BTB, history, state and counters, so
+   several of them can be fed the same trace in one pass */
+struct predictor {
+  const struct predictor_type *type;
+  const struct predictor_config *config;
+  struct branch_table btb;
+  struct return_stack ras;
+  struct indirect_predictor indirect;
+  struct global_history history;
+  unsigned int history_length;
+  void *state;
+  struct branch_profile profile;
+  unsigned long acum_hit;
+  unsigned long acum_miss;
+  unsigned long acum_miss_pred;
+};
+
+struct predictor_type {
+  const char *name;
+  void (*predict)(struct predictor *predictor, unsigned int index, unsigned long address, unsigned long size,
+                  unsigned long next_address, unsigned char *hit);
+  unsigned int history_length; /* Default, 0 when it uses no global history */
+  void (*init)(struct predictor *predictor);
+  void (*report)(const struct predictor *predictor); /* Extra statistics, may be NULL */
+};
+
+struct two_level_state {
+  unsigned char pattern_history[1 << HIST_SIZE];
+};
+
+/* The last history_length outcomes folded into length bits, kept up to
+   date with a shift and two xors per branch */
+struct folded_history {
+  unsigned int value;
+  unsigned int length;
+  unsigned int history_length;
+  unsigned int outpoint;
+};
+
+struct tage_entry {
+  signed char counter;
+  unsigned char useful;
+  unsigned short tag;
+};
+
+struct tage_state {
+  unsigned char bimodal[1 << TAGE_BIMODAL_BITS];
+  struct tage_entry tables[TAGE_TABLES][1 << TAGE_TABLE_BITS];
+  struct folded_history index_history[TAGE_TABLES];
+  struct folded_history tag_history[2][TAGE_TABLES];
+  int use_alt_on_na;
+  unsigned long branches;
+  unsigned int seed;
+};
+
+struct long_perceptron_state {
+  signed char bias[LONG_PERCEPTRON_ROWS];
+  unsigned int stride;
+  int threshold;
+  signed char weights[]; /* LONG_PERCEPTRON_ROWS rows of stride weights */
+};
+
+#define FEATURE_BIAS         0
+#define FEATURE_GLOBAL       1 /* Global history outcomes start to end branches ago */
+#define FEATURE_PATH         2 /* Path history bits start to end */
+#define FEATURE_LOCAL        3 /* Last start outcomes of this branch */
+#define FEATURE_RECENCY      4 /* Position of this branch among the last start distinct ones */
+#define FEATURE_LOOP         5 /* Taken outcomes of this branch in a row */
+
+struct hashed_feature {
+  unsigned int type;
+  unsigned int start;
+  unsigned int end;
+  unsigned int bits;
+  unsigned long offset; /* Of the table in weights */
+};
+
+struct hashed_perceptron_state {
+  struct hashed_feature features[HASHED_MAX_FEATURES];
+  unsigned int count;
+  int threshold;
+  unsigned short local_history[HASHED_LOCAL_ENTRIES];
+  unsigned char loop_count[HASHED_LOCAL_ENTRIES];
+  unsigned short recency[HASHED_MAX_RECENCY];
+  unsigned int recency_length;
+  unsigned long storage; /* Weights */
+  signed char weights[]; /* All tables back to back */
+};
+
+/* Resolved configuration of a run, what the results store keys it by */
+struct run_config {
+  char names[MAX_PREDICTORS][32];
+  unsigned int history_lengths[MAX_PREDICTORS];
+  struct hashed_feature features[HASHED_MAX_FEATURES]; /* Of the hashed perceptron, if any */
+  struct btb_config btb;
+  unsigned int ras_entries;
+  unsigned int profile_top;
+};
 
-int get_opcode(const char *filename, char *assembly, char *opcode, unsigned long *address, unsigned long *size, unsigned *is_cond) {
-  static FILE *file = NULL;
+int get_opcode(FILE *file, char *assembly, char *opcode, unsigned long *address, unsigned long *size, unsigned *is_cond) {
   char buf[CHUNK];
   char *sub_string = NULL;
   char *tmp_ptr = NULL;
   int i = 0, count = 0;
 
-  if(file == NULL) {
-    file = fopen(filename, "r");
-    if (file == NULL) {
-      fprintf(stderr, "Could not open file.\n");
-      exit(1);
-    }
-  }
+  /* Charged to parsing until the caller switches away */
+  SELF_PROFILE_SWITCH(SELF_PARSE);
 
   if(!fgets(buf, sizeof buf, file)) {
     return 0;
@@ -99,260 +426,1947 @@ int get_opcode(const char *filename, char *assembly, char *opcode, unsigned long
   return 1;
 }
 
-void not_taken_predictor(unsigned int index, unsigned long address, unsigned long size, unsigned long next_address, unsigned char *hit) {
-  if(address + size == next_address) {
-    *hit = 1;
+void init_global_history(struct global_history *history, unsigned int length) {
+  for(history->capacity = 128; history->capacity <= length; history->capacity <<= 1);
+
+  if((history->words = malloc(history->capacity / 8)) == NULL) {
+    fprintf(stderr, "Could not allocate global history.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  memset(history->words, 0, history->capacity / 8);
+  history->head = 0;
+  history->path = 0;
+}
+
+void push_global_history(struct global_history *history, int taken, unsigned long address) {
+  if(taken) {
+    history->words[history->head >> 6] |= 1UL << (history->head & 63);
   } else {
-    *hit = 0;
+    history->words[history->head >> 6] &= ~(1UL << (history->head & 63));
   }
+
+  history->head = (history->head - 1) & (history->capacity - 1);
+  history->path = (history->path << 1) | ((address ^ (address >> 2)) & 1);
 }
 
-void two_bit_predictor(unsigned int index, unsigned long address, unsigned long size, unsigned long next_address, unsigned char *hit) {
-  if(address + size == next_address) {
-    if(btb[index].counter < 2) {
-      *hit = 1;
-    } else {
-      *hit = 0;
-    }
+/* Outcome of the branch age branches ago, 0 is the newest */
+int global_history_bit(const struct global_history *history, unsigned int age) {
+  unsigned int position = (history->head + 1 + age) & (history->capacity - 1);
+
+  return (history->words[position >> 6] >> (position & 63)) & 1;
+}
+
+/* length (up to 64) outcomes starting age branches ago, the newest in bit 0 */
+unsigned long global_history_window(const struct global_history *history, unsigned int age, unsigned int length) {
+  unsigned int position = (history->head + 1 + age) & (history->capacity - 1);
+  unsigned int word = position >> 6, offset = position & 63;
+  unsigned long bits = history->words[word] >> offset;
+
+  if(offset != 0) {
+    bits |= history->words[(word + 1) & ((history->capacity >> 6) - 1)] << (64 - offset);
+  }
+
+  return (length < 64) ? (bits & ((1UL << length) - 1)) : bits;
+}
+
+/* The last length (up to 64) outcomes, the newest in bit 0 */
+unsigned long global_history_recent(const struct global_history *history, unsigned int length) {
+  return global_history_window(history, 0, length);
+}
+
+void *allocate_btb_array(unsigned long count, size_t size) {
+  void *array;
+
+  if((array = calloc(count, size)) == NULL) {
+    fprintf(stderr, "Could not allocate BTB.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  return array;
+}
+
+void init_btb(struct branch_table *btb, const struct btb_config *config) {
+  unsigned long entries = config->entries;
+
+  memset(btb, 0, sizeof(struct branch_table));
+  btb->ways = config->ways;
+  btb->sets = config->entries / config->ways;
+  btb->tag_bits = config->tag_bits;
+  btb->replacement = config->replacement;
+  btb->seed = 1;
+
+  for(btb->set_bits = 0; (1U << btb->set_bits) < btb->sets; ++btb->set_bits);
+
+  btb->tags = allocate_btb_array(entries, sizeof(unsigned int));
+  btb->targets = allocate_btb_array(entries, sizeof(unsigned long));
+  btb->histories = allocate_btb_array(entries, sizeof(unsigned char));
+  btb->counters = allocate_btb_array(entries, sizeof(unsigned char));
+  btb->indirect = allocate_btb_array(entries, sizeof(unsigned char));
+  btb->stamps = allocate_btb_array(entries, sizeof(unsigned long));
+
+  if((btb->l0_entries = config->l0_entries) > 0) {
+    btb->l0_tags = allocate_btb_array(btb->l0_entries, sizeof(unsigned int));
+    btb->l0_stamps = allocate_btb_array(btb->l0_entries, sizeof(unsigned long));
+  }
+}
+
+void free_btb(struct branch_table *btb) {
+  free(btb->tags);
+  free(btb->targets);
+  free(btb->histories);
+  free(btb->counters);
+  free(btb->indirect);
+  free(btb->stamps);
+  free(btb->l0_tags);
+  free(btb->l0_stamps);
+}
+
+/* Address bits above the set index folded into tag_bits, plus the valid bit */
+unsigned int btb_tag(unsigned long address, unsigned int set_bits, unsigned int tag_bits) {
+  unsigned long tag = address >> set_bits, folded = 0;
+
+  for(; tag != 0; tag >>= tag_bits) {
+    folded ^= tag & ((1UL << tag_bits) - 1);
+  }
+
+  return (unsigned int) folded | BTB_VALID;
+}
 
-    if(btb[index].counter > 0) {
-      --btb[index].counter;
+/* Way of tags (ways entries) holding tag, -1 if none */
+int btb_match(const unsigned int *tags, unsigned int ways, unsigned int tag) {
+  unsigned int way = 0;
+#if defined(__AVX2__) || defined(__SSE4_1__)
+  int mask;
+#endif
+#if defined(__AVX2__)
+  const __m256i key = _mm256_set1_epi32(tag);
+
+  for(; way + 8 <= ways; way += 8) {
+    mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) (tags + way)), key)));
+
+    if(mask != 0) {
+      return way + __builtin_ctz(mask);
     }
-  } else {
-    if(btb[index].counter < 2 || btb[index].target != next_address) {
-      *hit = 0;
-    } else {
-      *hit = 1;
+  }
+#endif
+#if defined(__AVX2__) || defined(__SSE4_1__)
+  const __m128i key4 = _mm_set1_epi32(tag);
+
+  for(; way + 4 <= ways; way += 4) {
+    mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (tags + way)), key4)));
+
+    if(mask != 0) {
+      return way + __builtin_ctz(mask);
     }
+  }
+#endif
 
-    if(btb[index].counter < 3) {
-      ++btb[index].counter;
+  for(; way < ways; ++way) {
+    if(tags[way] == tag) {
+      return way;
     }
   }
+
+  return -1;
 }
 
-void two_level_predictor(unsigned int index, unsigned long address, unsigned long size, unsigned long next_address, unsigned char *hit) {
-  static unsigned char pattern_history[1 << HIST_SIZE] = { 0 };
-  static int initialized = 0;
-  char predict_taken;
-  unsigned int i;
+/* Invalid ways first, then by replacement policy */
+unsigned int btb_victim(struct branch_table *btb, const unsigned int *tags, const unsigned long *stamps, unsigned int ways) {
+  unsigned int way, victim = 0;
 
-  if(initialized == 0) {
-    for(i = 0; i < (1 << HIST_SIZE); ++i) {
-      pattern_history[i] = 0;
+  for(way = 0; way < ways; ++way) {
+    if((tags[way] & BTB_VALID) == 0) {
+      return way;
     }
-
-    initialized = 1;
   }
 
-  predict_taken = (pattern_history[btb[index].history] < 2);
+  if(btb->replacement == BTB_RANDOM) {
+    btb->seed = btb->seed * 1103515245 + 12345;
+    return (btb->seed >> 16) % ways;
+  }
 
-  if(address + size == next_address) {
-    if(predict_taken == 0) {
-      *hit = 1;
-    } else {
-      *hit = 0;
+  for(way = 1; way < ways; ++way) {
+    if(stamps[way] < stamps[victim]) {
+      victim = way;
     }
+  }
 
-    if(pattern_history[btb[index].history] > 0) {
-      --pattern_history[btb[index].history];
-    }
+  return victim;
+}
 
-    btb[index].history = (btb[index].history << 1);
-  } else {
-    if(predict_taken == 0 || btb[index].target != next_address) {
-      *hit = 0;
+/* Entry of the branch at address, -1 on a miss */
+int btb_lookup(struct branch_table *btb, unsigned long address) {
+  unsigned int set = address & (btb->sets - 1), tag, l0_tag;
+  int way, l0_way;
+
+  tag = btb_tag(address, btb->set_bits, btb->tag_bits);
+
+  if((way = btb_match(&btb->tags[set * btb->ways], btb->ways, tag)) < 0) {
+    return -1;
+  }
+
+  if(btb->replacement == BTB_LRU) {
+    btb->stamps[set * btb->ways + way] = ++btb->clock;
+  }
+
+  /* The first level only decides how fast the target is available */
+  if(btb->l0_entries > 0) {
+    l0_tag = btb_tag(address, 0, btb->tag_bits);
+
+    if((l0_way = btb_match(btb->l0_tags, btb->l0_entries, l0_tag)) >= 0) {
+      ++btb->l0_hits;
+
+      if(btb->replacement == BTB_LRU) {
+        btb->l0_stamps[l0_way] = ++btb->clock;
+      }
     } else {
-      *hit = 1;
+      ++btb->l1_hits;
+      l0_way = btb_victim(btb, btb->l0_tags, btb->l0_stamps, btb->l0_entries);
+      btb->l0_tags[l0_way] = l0_tag;
+      btb->l0_stamps[l0_way] = ++btb->clock;
     }
+  }
 
-    if(pattern_history[btb[index].history] < 3) {
-      ++pattern_history[btb[index].history];
-    }
+  return set * btb->ways + way;
+}
 
-    btb[index].history = (btb[index].history << 1) | 0x1;
+/* Allocates an entry for the branch at address and clears its state */
+unsigned int btb_insert(struct branch_table *btb, unsigned long address) {
+  unsigned int set = address & (btb->sets - 1), entry, l0_way;
+
+  entry = set * btb->ways + btb_victim(btb, &btb->tags[set * btb->ways], &btb->stamps[set * btb->ways], btb->ways);
+  btb->tags[entry] = btb_tag(address, btb->set_bits, btb->tag_bits);
+  btb->targets[entry] = 0;
+  btb->histories[entry] = 0;
+  btb->counters[entry] = 0;
+  btb->indirect[entry] = 0;
+  btb->stamps[entry] = ++btb->clock;
+
+  if(btb->l0_entries > 0) {
+    l0_way = btb_victim(btb, btb->l0_tags, btb->l0_stamps, btb->l0_entries);
+    btb->l0_tags[l0_way] = btb_tag(address, 0, btb->tag_bits);
+    btb->l0_stamps[l0_way] = btb->clock;
   }
+
+  return entry;
 }
 
-void two_level_predictor_v2(unsigned int index, unsigned long address, unsigned long size, unsigned long next_address, unsigned char *hit) {
-  static unsigned char pattern_history[1 << HIST_SIZE];
-  static int bhr[HIST_SIZE];
-  static int initialized = 0;
-  unsigned long next_fetch;
-  unsigned int pht_idx, i, k;
+/* Parses entries[,ways[,tag bits[,lru|fifo|random[,first level entries]]]] */
+void parse_btb_config(const char *spec, struct btb_config *config) {
+  static const char *policies[] = { "lru", "fifo", "random" };
+  char policy[16] = "lru";
+  unsigned int i;
 
-  if(initialized == 0) {
-    for(i = 0; i < (1 << HIST_SIZE); ++i) {
-      pattern_history[i] = 0;
-    }
+  config->ways = 1;
+  config->l0_entries = 0;
 
-    for(i = 0; i < HIST_SIZE; ++i) {
-      bhr[i] = 0;
-    }
+  /* %u takes a sign, so negative numbers are caught here */
+  if(strspn(spec, "0123456789,abcdefghijklmnopqrstuvwxyz") != strlen(spec) ||
+     sscanf(spec, "%u,%u,%u,%15[a-z],%u", &config->entries, &config->ways, &config->tag_bits, policy, &config->l0_entries) < 1) {
+    fprintf(stderr, "Invalid BTB configuration: %s\n", spec);
+    exit(EXIT_FAILURE);
+  }
+
+  for(i = 0; i < sizeof policies / sizeof policies[0] && strcmp(policies[i], policy) != 0; ++i);
 
-    initialized = 1;
+  if(i == sizeof policies / sizeof policies[0]) {
+    fprintf(stderr, "Unknown BTB replacement policy: %s\n", policy);
+    exit(EXIT_FAILURE);
   }
 
-  for(pht_idx = 0, k = 0; k < HIST_SIZE; ++k) {
-    pht_idx += bhr[k] << ((HIST_SIZE - 1) - k);
+  config->replacement = i;
+
+  if(config->entries == 0 || config->ways == 0 || config->entries < config->ways || config->entries % config->ways != 0 || ((config->entries / config->ways) & (config->entries / config->ways - 1)) != 0 ||
+     config->tag_bits < 1 || config->tag_bits > 31) {
+    fprintf(stderr, "BTB sets must be a nonzero power of two and tags 1 to 31 bits.\n");
+    exit(EXIT_FAILURE);
   }
 
-  pht_idx ^= address & 0xF;
-  next_fetch = (pattern_history[pht_idx] >= 2) ? (btb[index].target) : (address + size);
+  if(config->l0_entries > config->entries) {
+    fprintf(stderr, "The first level BTB cannot be larger than the second.\n");
+    exit(EXIT_FAILURE);
+  }
+}
 
-  if(next_fetch == next_address) {
-    *hit = 1;
-  } else {
-    *hit = 0;
+/* Calls and returns are told apart by their mnemonic, jumps are indirect
+   once they are seen jumping somewhere else */
+unsigned int classify_branch(const char *assembly, unsigned int is_cond) {
+  if(is_cond) {
+    return BRANCH_CONDITIONAL;
   }
 
-  if(next_address == address + size) {
-    if(pattern_history[pht_idx] > 0) {
-      --pattern_history[pht_idx];
+  /* Traces spell mnemonics in either case, RET_NEAR or ret */
+  if(strncasecmp(assembly, "ret", 3) == 0 || strncasecmp(assembly, "iret", 4) == 0) {
+    return BRANCH_RETURN;
+  }
+
+  if(strncasecmp(assembly, "call", 4) == 0) {
+    return BRANCH_CALL;
+  }
+
+  return BRANCH_JUMP;
+}
+
+void open_trace(struct trace_reader *reader, const char *trace) {
+  memset(reader, 0, sizeof(struct trace_reader));
+
+  if((reader->file = fopen(trace, "rb")) == NULL) {
+    fprintf(stderr, "Could not open file.\n");
+    exit(1);
+  }
+
+  if(fread(&reader->header, sizeof reader->header, 1, reader->file) == 1 &&
+     memcmp(reader->header.magic, COMPACT_MAGIC, sizeof reader->header.magic) == 0) {
+    if(reader->header.version != COMPACT_VERSION) {
+      fprintf(stderr, "Unsupported compact trace version %u.\n", reader->header.version);
+      exit(2);
     }
-  } else {
-    if(pattern_history[pht_idx] < 3) {
-      ++pattern_history[pht_idx];
+
+    reader->compact = 1;
+    return;
+  }
+
+  rewind(reader->file);
+}
+
+void close_trace(struct trace_reader *reader) {
+  fclose(reader->file);
+}
+
+int read_varint(FILE *file, unsigned long *value) {
+  unsigned int shift;
+  int byte;
+
+  for(*value = 0, shift = 0; (byte = getc(file)) != EOF; shift += 7) {
+    *value |= (unsigned long) (byte & 0x7F) << shift;
+
+    if((byte & 0x80) == 0) {
+      return 1;
     }
   }
 
-  for(i = 0; i < HIST_SIZE - 1; ++i) {
-    bhr[i] = bhr[i + 1];
+  return 0;
+}
+
+void write_varint(FILE *file, unsigned long value) {
+  for(; value >= 0x80; value >>= 7) {
+    putc((value & 0x7F) | 0x80, file);
+  }
+
+  putc(value, file);
+}
+
+int read_compact_branch(struct trace_reader *reader, struct branch_record *branch) {
+  unsigned long address_delta, target_delta;
+  int kind;
+
+  SELF_PROFILE_SWITCH(SELF_PARSE);
+
+  if((kind = getc(reader->file)) == EOF) {
+    reader->records = reader->header.records;
+    reader->tail = reader->header.tail;
+    return 0;
+  }
+
+  if(!read_varint(reader->file, &branch->run) || !read_varint(reader->file, &address_delta) ||
+     !read_varint(reader->file, &branch->size) || !read_varint(reader->file, &target_delta)) {
+    fprintf(stderr, "Error reading compact trace (Truncated record)\n");
+    exit(2);
   }
 
-  bhr[HIST_SIZE - 1] = (next_address != address + size);
+  branch->kind = kind;
+  branch->address = reader->previous + ((address_delta >> 1) ^ -(address_delta & 1));
+  branch->next_address = branch->address + branch->size + ((target_delta >> 1) ^ -(target_delta & 1));
+  reader->previous = branch->next_address;
+  reader->records += branch->run + 1;
+  return 1;
 }
 
-void perceptron_predictor(unsigned int index, unsigned long address, unsigned long size, unsigned long next_address, unsigned char *hit) {
-  static int perceptron_weights[NUM_COUNTERS][HIST_SIZE];
-  static int bhr[HIST_SIZE];
-  static int initialized = 0;
-  unsigned long next_fetch;
-  unsigned int pt_idx, i, k;
-  int pred, target;
+/* Returns 0 at the end of the trace, when the non-branch instructions after
+   the last branch are in reader->tail */
+int read_branch(struct trace_reader *reader, struct branch_record *branch) {
+  unsigned long run = 0;
+
+  if(reader->compact) {
+    return read_compact_branch(reader, branch);
+  }
 
-  if(initialized == 0) {
-    for(i = 0; i < NUM_COUNTERS; ++i) {
-      for(k = 0; k < HIST_SIZE; ++k) {
-        perceptron_weights[i][k] = 1;
+  while(reader->pending || get_opcode(reader->file, reader->assembly, reader->opcode, &reader->address, &reader->size,
+                                      &reader->is_cond)) {
+    reader->pending = 0;
+    ++reader->records;
+
+    if(strncmp(reader->opcode, "OP_BRANCH", 9) == 0) {
+      branch->kind = classify_branch(reader->assembly, reader->is_cond);
+      branch->address = reader->address;
+      branch->size = reader->size;
+      branch->run = run;
+
+      /* The branch target is the address of the next record */
+      if(get_opcode(reader->file, reader->assembly, reader->opcode, &reader->address, &reader->size, &reader->is_cond)) {
+        branch->next_address = reader->address;
+        reader->pending = 1;
+        return 1;
       }
+    } else {
+      ++run;
     }
+  }
 
-    for(i = 0; i < HIST_SIZE; ++i) {
-      bhr[i] = 1;
-    }
+  reader->tail = run;
+  return 0;
+}
+
+/* Writes the branches of a text trace as a compact trace */
+void convert_trace(const char *trace, const char *output) {
+  struct trace_reader reader;
+  struct compact_header header;
+  struct branch_record branch;
+  unsigned long previous = 0;
+  long delta;
+  FILE *file;
+
+  open_trace(&reader, trace);
 
-    initialized = 1;
+  if(reader.compact || (file = fopen(output, "wb")) == NULL) {
+    fprintf(stderr, "Could not convert %s to %s.\n", trace, output);
+    exit(1);
   }
 
-  for(pt_idx = 0, k = 0; k < HIST_SIZE; ++k) {
-    pt_idx += bhr[k] << ((HIST_SIZE - 1) - k);
+  memset(&header, 0, sizeof header);
+  memcpy(header.magic, COMPACT_MAGIC, sizeof header.magic);
+  header.version = COMPACT_VERSION;
+  fwrite(&header, sizeof header, 1, file);
+
+  while(read_branch(&reader, &branch)) {
+    putc(branch.kind, file);
+    write_varint(file, branch.run);
+    delta = branch.address - previous;
+    write_varint(file, ((unsigned long) delta << 1) ^ (unsigned long) (delta >> 63));
+    write_varint(file, branch.size);
+    delta = branch.next_address - (branch.address + branch.size);
+    write_varint(file, ((unsigned long) delta << 1) ^ (unsigned long) (delta >> 63));
+    previous = branch.next_address;
+    ++header.branches;
   }
 
-  pt_idx ^= address & 0xF;
+  /* The header is written again with the counts */
+  header.records = reader.records;
+  header.tail = reader.tail;
+  rewind(file);
 
-  for(pred = 0, i = 0; i < HIST_SIZE; ++i) {
-    pred += perceptron_weights[pt_idx][i] * (bhr[i] == 0 ? (-1) : (1));
+  if(fwrite(&header, sizeof header, 1, file) != 1 || fclose(file) != 0) {
+    fprintf(stderr, "Could not write %s.\n", output);
+    exit(1);
   }
 
-  next_fetch = (pred > 0) ? (btb[index].target) : (address + size);
+  close_trace(&reader);
+  fprintf(stdout, "Branches/Records: %lu/%lu\n", header.branches, header.records);
+}
 
-  if(next_fetch == next_address) {
-    *hit = 1;
+void init_return_stack(struct return_stack *ras, unsigned int size) {
+  memset(ras, 0, sizeof(struct return_stack));
+
+  if((ras->size = size) > 0 && (ras->entries = calloc(size, sizeof(unsigned long))) == NULL) {
+    fprintf(stderr, "Could not allocate return address stack.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void push_return_stack(struct return_stack *ras, unsigned long return_address) {
+  ras->top = (ras->top + 1) % ras->size;
+  ras->entries[ras->top] = return_address;
+
+  if(ras->depth < ras->size) {
+    ++ras->depth;
   } else {
-    *hit = 0;
+    ++ras->overflows;
   }
+}
 
-  target = (next_address == size + address) ? (-1) : (1);
+/* Returns 0 when the stack is empty */
+unsigned long pop_return_stack(struct return_stack *ras) {
+  unsigned long return_address;
+
+  if(ras->depth == 0) {
+    return 0;
+  }
+
+  return_address = ras->entries[ras->top];
+  ras->top = (ras->top + ras->size - 1) % ras->size;
+  --ras->depth;
+  return return_address;
+}
 
-  if(*hit == 0 || abs(pred) < HIST_SIZE) {
-    for(i = 0; i < HIST_SIZE; ++i) {
-      perceptron_weights[pt_idx][i] += target * (bhr[i] == 0 ? (-1) : (1));
+void init_indirect_predictor(struct indirect_predictor *indirect) {
+  unsigned int i;
+
+  memset(indirect, 0, sizeof(struct indirect_predictor));
+
+  for(i = 0; i < ITTAGE_TABLES; ++i) {
+    if((indirect->tables[i] = calloc(1 << ITTAGE_TABLE_BITS, sizeof(struct ittage_entry))) == NULL) {
+      fprintf(stderr, "Could not allocate indirect predictor.\n");
+      exit(EXIT_FAILURE);
     }
+
+    indirect->history_lengths[i] = (unsigned int) (ITTAGE_MIN_HISTORY * pow((double) ITTAGE_MAX_HISTORY / ITTAGE_MIN_HISTORY,
+                                                                            (double) i / (ITTAGE_TABLES - 1)) + 0.5);
   }
 
-  for(i = 0; i < HIST_SIZE - 1; ++i) {
-    bhr[i] = bhr[i + 1];
+  init_global_history(&indirect->history, ITTAGE_MAX_HISTORY);
+  indirect->seed = 1;
+}
+
+void free_indirect_predictor(struct indirect_predictor *indirect) {
+  unsigned int i;
+
+  for(i = 0; i < ITTAGE_TABLES; ++i) {
+    free(indirect->tables[i]);
   }
 
-  bhr[HIST_SIZE - 1] = (next_address != address + size);
+  free(indirect->history.words);
 }
 
-int main(int argc, const char *argv[]) {
-  char assembly[20];
-  char opcode[20];
-  unsigned char hit;
-  unsigned long address, next_address;
-  unsigned long size, next_size;
-  unsigned long cycles = 0;
-  unsigned long acum_hit = 0, acum_miss = 0, acum_miss_pred = 0;
-  unsigned int is_cond, next_is_cond; 
-  unsigned int index, added_recently;
+/* Histories are at most 64 bits, so they are folded straight from one window */
+unsigned long fold_history(unsigned long history, unsigned int bits) {
+  unsigned long folded = 0;
 
-  if(argc < 2) {
-    fprintf(stdout, "Uso: %s <trace file>\n", argv[0]);
-    exit(0);
+  for(; history != 0; history >>= bits) {
+    folded ^= history & ((1UL << bits) - 1);
   }
 
-  for(index = 0; index < BTB_SIZE; ++index) {
-    btb[index].address = 0;
-    btb[index].valid = 0;
+  return folded;
+}
+
+/* Predicts the target of the branch at address, base_target when no table
+   matches, and trains with its actual target */
+unsigned long predict_indirect(struct indirect_predictor *indirect, unsigned long address, unsigned long base_target,
+                               unsigned long target) {
+  struct ittage_entry *entry, *provider = NULL;
+  unsigned int indexes[ITTAGE_TABLES], tags[ITTAGE_TABLES];
+  unsigned long history, path, predicted;
+  int i, provider_table = -1;
+
+  for(i = 0; i < ITTAGE_TABLES; ++i) {
+    /* Only as many path bits as the table's history length, as in TAGE */
+    path = indirect->history.path & ((1UL << ((indirect->history_lengths[i] < TAGE_PATH_BITS) ?
+                                              indirect->history_lengths[i] : TAGE_PATH_BITS)) - 1);
+    history = global_history_recent(&indirect->history, indirect->history_lengths[i]) ^ (path << 1);
+    indexes[i] = (address ^ (address >> ITTAGE_TABLE_BITS) ^ fold_history(history, ITTAGE_TABLE_BITS) ^ i) & ((1 << ITTAGE_TABLE_BITS) - 1);
+    tags[i] = (address ^ fold_history(history, ITTAGE_TAG_BITS - 1) << 1) & ((1 << ITTAGE_TAG_BITS) - 1);
   }
 
-  size = 0;
+  for(i = ITTAGE_TABLES - 1; i >= 0 && provider == NULL; --i) {
+    if(indirect->tables[i][indexes[i]].tag == tags[i] && indirect->tables[i][indexes[i]].target != 0) {
+      provider = &indirect->tables[i][indexes[i]];
+      provider_table = i;
+    }
+  }
 
-  while(size != 0 || get_opcode(argv[1], assembly, opcode, &address, &size, &is_cond)) {
-    next_size = 0;
+  predicted = (provider != NULL) ? provider->target : base_target;
 
-    if(strncmp(opcode, "OP_BRANCH", 9) == 0) {
-      index = address & 63;
-      added_recently = 0;
+  if(predicted == target) {
+    ++indirect->hits;
+  } else {
+    ++indirect->misses;
+  }
 
-      if(get_opcode(argv[1], assembly, opcode, &next_address, &next_size, &next_is_cond)) {
-        if(btb[index].valid == 0 || btb[index].address != address) {
-          btb[index].address = address;
-          btb[index].valid = 1;
-          btb[index].history = 0;
-          btb[index].counter = 0;
-          btb[index].target = 0;
+  if(provider != NULL) {
+    if(provider->target == target) {
+      if(provider->confidence < ITTAGE_CONFIDENCE_MAX) {
+        ++provider->confidence;
+      }
 
-          if(next_address != address + size) {
-            ++acum_miss;
-          } else {
-            ++acum_hit;
-          }
+      if(base_target != target && provider->useful < 1) {
+        provider->useful = 1;
+      }
+    } else if(provider->confidence > 0) {
+      --provider->confidence;
+    } else {
+      provider->target = target;
+    }
+  }
 
-          added_recently = 1;
-        }
+  /* On a misprediction, an entry is allocated in a longer history table */
+  if(predicted != target && provider_table < ITTAGE_TABLES - 1) {
+    indirect->seed = indirect->seed * 1103515245 + 12345;
+    i = provider_table + 1 + ((provider_table < ITTAGE_TABLES - 2) ? ((indirect->seed >> 16) & 1) : 0);
 
-        if(added_recently == 0) {
-          if(is_cond) {
-            BRANCH_PREDICTOR(index, address, size, next_address, &hit);
-
-            if(hit == 1) {
-              ++acum_hit;
-            } else {
-              ++acum_miss_pred;
-            }
-          } else {
-            ++acum_hit;
-          }
-        }
+    for(; i < ITTAGE_TABLES; ++i) {
+      entry = &indirect->tables[i][indexes[i]];
 
-        if(next_address != address + size) {
-          btb[index].target = next_address;
-        }
+      if(entry->useful == 0) {
+        entry->tag = tags[i];
+        entry->target = target;
+        entry->confidence = 0;
+        break;
       }
-    } else {
-      ++cycles;
+
+      entry->useful = 0;
     }
+  }
+
+  push_global_history(&indirect->history, (target ^ (target >> 3)) & 1, target);
+  return predicted;
+}
+
+void not_taken_predictor(struct predictor *predictor, unsigned int index, unsigned long address, unsigned long size,
+                         unsigned long next_address, unsigned char *hit) {
+  if(address + size == next_address) {
+    *hit = 1;
+  } else {
+    *hit = 0;
+  }
+}
+
+void two_bit_predictor(struct predictor *predictor, unsigned int index, unsigned long address, unsigned long size,
+                       unsigned long next_address, unsigned char *hit) {
+  unsigned char *counter = &predictor->btb.counters[index];
+
+  if(address + size == next_address) {
+    if(*counter < 2) {
+      *hit = 1;
+    } else {
+      *hit = 0;
+    }
+
+    if(*counter > 0) {
+      --*counter;
+    }
+  } else {
+    if(*counter < 2 || predictor->btb.targets[index] != next_address) {
+      *hit = 0;
+    } else {
+      *hit = 1;
+    }
+
+    if(*counter < 3) {
+      ++*counter;
+    }
+  }
+}
+
+void init_two_level_predictor(struct predictor *predictor) {
+  if((predictor->state = calloc(1, sizeof(struct two_level_state))) == NULL) {
+    fprintf(stderr, "Could not allocate predictor state.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void two_level_predictor(struct predictor *predictor, unsigned int index, unsigned long address, unsigned long size,
+                         unsigned long next_address, unsigned char *hit) {
+  unsigned char *pattern_history = ((struct two_level_state *) predictor->state)->pattern_history;
+  unsigned char *history = &predictor->btb.histories[index];
+  char predict_taken;
+
+  predict_taken = (pattern_history[*history] < 2);
+
+  if(address + size == next_address) {
+    if(predict_taken == 0) {
+      *hit = 1;
+    } else {
+      *hit = 0;
+    }
+
+    if(pattern_history[*history] > 0) {
+      --pattern_history[*history];
+    }
+
+    *history = (*history << 1) & ((1 << HIST_SIZE) - 1);
+  } else {
+    if(predict_taken == 0 || predictor->btb.targets[index] != next_address) {
+      *hit = 0;
+    } else {
+      *hit = 1;
+    }
+
+    if(pattern_history[*history] < 3) {
+      ++pattern_history[*history];
+    }
+
+    *history = ((*history << 1) | 0x1) & ((1 << HIST_SIZE) - 1);
+  }
+}
+
+void init_two_level_predictor_v2(struct predictor *predictor) {
+  if(predictor->history_length > MAX_PHT_HISTORY) {
+    fprintf(stderr, "The two-level predictor takes at most %d history bits.\n", MAX_PHT_HISTORY);
+    exit(EXIT_FAILURE);
+  }
+
+  /* The pattern history table */
+  if((predictor->state = calloc(1UL << predictor->history_length, 1)) == NULL) {
+    fprintf(stderr, "Could not allocate predictor state.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void two_level_predictor_v2(struct predictor *predictor, unsigned int index, unsigned long address, unsigned long size,
+                            unsigned long next_address, unsigned char *hit) {
+  unsigned char *pattern_history = predictor->state;
+  unsigned long next_fetch, pht_idx;
+
+  pht_idx = global_history_recent(&predictor->history, predictor->history_length);
+  pht_idx ^= address & ((1UL << predictor->history_length) - 1);
+  next_fetch = (pattern_history[pht_idx] >= 2) ? (predictor->btb.targets[index]) : (address + size);
+
+  if(next_fetch == next_address) {
+    *hit = 1;
+  } else {
+    *hit = 0;
+  }
+
+  if(next_address == address + size) {
+    if(pattern_history[pht_idx] > 0) {
+      --pattern_history[pht_idx];
+    }
+  } else {
+    if(pattern_history[pht_idx] < 3) {
+      ++pattern_history[pht_idx];
+    }
+  }
+
+  push_global_history(&predictor->history, next_address != address + size, address);
+}
+
+/* Weights of row r are perceptron_weights[r * history_length ...], weight i
+   goes with the outcome history_length - 1 - i branches ago */
+void init_perceptron_predictor(struct predictor *predictor) {
+  int *perceptron_weights;
+  unsigned int i;
+
+  if((perceptron_weights = malloc(NUM_COUNTERS * predictor->history_length * sizeof(int))) == NULL) {
+    fprintf(stderr, "Could not allocate predictor state.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for(i = 0; i < NUM_COUNTERS * predictor->history_length; ++i) {
+    perceptron_weights[i] = 1;
+  }
+
+  /* The history starts out all taken */
+  memset(predictor->history.words, 0xFF, predictor->history.capacity / 8);
+  predictor->state = perceptron_weights;
+}
+
+void perceptron_predictor(struct predictor *predictor, unsigned int index, unsigned long address, unsigned long size,
+                          unsigned long next_address, unsigned char *hit) {
+  unsigned int length = predictor->history_length;
+  int *perceptron_weights;
+  unsigned long next_fetch;
+  unsigned int pt_idx, i;
+  int pred, target;
+
+  pt_idx = (global_history_recent(&predictor->history, length) ^ address) & (NUM_COUNTERS - 1);
+  perceptron_weights = (int *) predictor->state + pt_idx * length;
+
+  for(pred = 0, i = 0; i < length; ++i) {
+    pred += perceptron_weights[i] * (global_history_bit(&predictor->history, length - 1 - i) == 0 ? (-1) : (1));
+  }
+
+  next_fetch = (pred > 0) ? (predictor->btb.targets[index]) : (address + size);
+
+  if(next_fetch == next_address) {
+    *hit = 1;
+  } else {
+    *hit = 0;
+  }
+
+  target = (next_address == size + address) ? (-1) : (1);
+
+  if(*hit == 0 || abs(pred) < (int) length) {
+    for(i = 0; i < length; ++i) {
+      perceptron_weights[i] += target * (global_history_bit(&predictor->history, length - 1 - i) == 0 ? (-1) : (1));
+    }
+  }
+
+  push_global_history(&predictor->history, next_address != address + size, address);
+}
+
+void init_folded_history(struct folded_history *folded, unsigned int history_length, unsigned int length) {
+  folded->value = 0;
+  folded->length = length;
+  folded->history_length = history_length;
+  folded->outpoint = history_length % length;
+}
+
+/* The newest outcome is shifted in and the one leaving the window xored out */
+void update_folded_history(struct folded_history *folded, const struct global_history *history) {
+  folded->value = (folded->value << 1) | global_history_bit(history, 0);
+  folded->value ^= global_history_bit(history, folded->history_length) << folded->outpoint;
+  folded->value ^= folded->value >> folded->length;
+  folded->value &= (1U << folded->length) - 1;
+}
+
+void init_tage_predictor(struct predictor *predictor) {
+  struct tage_state *tage;
+  unsigned int i, length;
+
+  if(predictor->history_length <= TAGE_MIN_HISTORY) {
+    fprintf(stderr, "TAGE needs more than %d history bits.\n", TAGE_MIN_HISTORY);
+    exit(EXIT_FAILURE);
+  }
+
+  if((tage = calloc(1, sizeof(struct tage_state))) == NULL) {
+    fprintf(stderr, "Could not allocate predictor state.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  memset(tage->bimodal, 1, sizeof tage->bimodal);
+
+  /* The longest table uses the whole history */
+  for(i = 0; i < TAGE_TABLES; ++i) {
+    length = (unsigned int) (TAGE_MIN_HISTORY * pow((double) predictor->history_length / TAGE_MIN_HISTORY,
+                                                    (double) i / (TAGE_TABLES - 1)) + 0.5);
+    init_folded_history(&tage->index_history[i], length, TAGE_TABLE_BITS);
+    init_folded_history(&tage->tag_history[0][i], length, TAGE_TAG_BITS);
+    init_folded_history(&tage->tag_history[1][i], length, TAGE_TAG_BITS - 1);
+  }
+
+  tage->seed = 1;
+  predictor->state = tage;
+}
+
+void tage_predictor(struct predictor *predictor, unsigned int index, unsigned long address, unsigned long size,
+                    unsigned long next_address, unsigned char *hit) {
+  struct tage_state *tage = predictor->state;
+  struct tage_entry *entry, *provider = NULL, *alternate = NULL;
+  unsigned int indexes[TAGE_TABLES], tags[TAGE_TABLES], path;
+  unsigned char *bimodal = &tage->bimodal[address & ((1 << TAGE_BIMODAL_BITS) - 1)];
+  unsigned int j;
+  int i, provider_table = -1, taken, provider_taken, alternate_taken, new_entry = 0, allocated;
+  unsigned long next_fetch;
+
+  for(i = 0; i < TAGE_TABLES; ++i) {
+    path = predictor->history.path & ((1U << ((tage->index_history[i].history_length < TAGE_PATH_BITS) ?
+                                              tage->index_history[i].history_length : TAGE_PATH_BITS)) - 1);
+    indexes[i] = (address ^ (address >> (TAGE_TABLE_BITS + i)) ^ tage->index_history[i].value ^ path ^ (path >> TAGE_TABLE_BITS)) &
+                 ((1 << TAGE_TABLE_BITS) - 1);
+    tags[i] = (address ^ tage->tag_history[0][i].value ^ (tage->tag_history[1][i].value << 1)) & ((1 << TAGE_TAG_BITS) - 1);
+  }
+
+  /* The longest matching history provides, the next one is the alternate */
+  for(i = TAGE_TABLES - 1; i >= 0; --i) {
+    entry = &tage->tables[i][indexes[i]];
+
+    if(entry->tag == tags[i]) {
+      if(provider == NULL) {
+        provider = entry;
+        provider_table = i;
+      } else {
+        alternate = entry;
+        break;
+      }
+    }
+  }
+
+  alternate_taken = (alternate != NULL) ? (alternate->counter >= 0) : (*bimodal >= 2);
+  provider_taken = (provider != NULL) ? (provider->counter >= 0) : alternate_taken;
+  taken = provider_taken;
+
+  /* Newly allocated entries are often worse than the alternate */
+  if(provider != NULL && provider->useful == 0 && (provider->counter == 0 || provider->counter == -1)) {
+    new_entry = 1;
+    taken = (tage->use_alt_on_na >= 0) ? alternate_taken : provider_taken;
+  }
+
+  next_fetch = (taken) ? (predictor->btb.targets[index]) : (address + size);
+
+  if(next_fetch == next_address) {
+    *hit = 1;
+  } else {
+    *hit = 0;
+  }
+
+  taken = (next_address != address + size);
+
+  if(new_entry != 0 && provider_taken != alternate_taken) {
+    if(alternate_taken == taken && tage->use_alt_on_na < TAGE_USE_ALT_MAX) {
+      ++tage->use_alt_on_na;
+    } else if(alternate_taken != taken && tage->use_alt_on_na > TAGE_USE_ALT_MIN) {
+      --tage->use_alt_on_na;
+    }
+  }
+
+  /* On a misprediction, an entry is allocated in a longer history table */
+  if(provider_taken != taken && provider_table < TAGE_TABLES - 1) {
+    tage->seed = tage->seed * 1103515245 + 12345;
+    allocated = 0;
+
+    i = provider_table + 1;
+
+    /* Skipping the first candidate now and then spreads allocations */
+    if(i < TAGE_TABLES - 1 && ((tage->seed >> 16) & 1)) {
+      ++i;
+    }
+
+    for(; i < TAGE_TABLES; ++i) {
+      entry = &tage->tables[i][indexes[i]];
+
+      if(entry->useful == 0) {
+        entry->tag = tags[i];
+        entry->counter = (taken) ? 0 : -1;
+        allocated = 1;
+        break;
+      }
+    }
+
+    if(allocated == 0) {
+      for(i = provider_table + 1; i < TAGE_TABLES; ++i) {
+        if(tage->tables[i][indexes[i]].useful > 0) {
+          --tage->tables[i][indexes[i]].useful;
+        }
+      }
+    }
+  }
+
+  if(provider != NULL) {
+    if(taken && provider->counter < TAGE_COUNTER_MAX) {
+      ++provider->counter;
+    } else if(!taken && provider->counter > TAGE_COUNTER_MIN) {
+      --provider->counter;
+    }
+
+    if(provider_taken != alternate_taken) {
+      if(provider_taken == taken && provider->useful < TAGE_USEFUL_MAX) {
+        ++provider->useful;
+      } else if(provider_taken != taken && provider->useful > 0) {
+        --provider->useful;
+      }
+    }
+  }
+
+  /* The alternate also learns while a new provider is not trusted yet */
+  if(alternate != NULL && new_entry != 0) {
+    if(taken && alternate->counter < TAGE_COUNTER_MAX) {
+      ++alternate->counter;
+    } else if(!taken && alternate->counter > TAGE_COUNTER_MIN) {
+      --alternate->counter;
+    }
+  } else if(provider == NULL || new_entry != 0) {
+    if(taken && *bimodal < 3) {
+      ++*bimodal;
+    } else if(!taken && *bimodal > 0) {
+      --*bimodal;
+    }
+  }
+
+  /* Graceful aging, so entries that stopped being useful can be replaced */
+  if(++tage->branches % TAGE_AGING_PERIOD == 0) {
+    for(i = 0; i < TAGE_TABLES; ++i) {
+      for(j = 0; j < (1 << TAGE_TABLE_BITS); ++j) {
+        tage->tables[i][j].useful >>= 1;
+      }
+    }
+  }
+
+  push_global_history(&predictor->history, taken, address);
+
+  for(i = 0; i < TAGE_TABLES; ++i) {
+    update_folded_history(&tage->index_history[i], &predictor->history);
+    update_folded_history(&tage->tag_history[0][i], &predictor->history);
+    update_folded_history(&tage->tag_history[1][i], &predictor->history);
+  }
+}
+
+/* Byte i of the result is 0xFF when bit i of bits is set */
+#if defined(__AVX2__)
+__m256i expand_bits(unsigned int bits) {
+  const __m256i bytes = _mm256_setr_epi64x(0x0000000000000000, 0x0101010101010101, 0x0202020202020202, 0x0303030303030303);
+  const __m256i select = _mm256_set1_epi64x(0x8040201008040201);
+
+  return _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_shuffle_epi8(_mm256_set1_epi32(bits), bytes), select), select);
+}
+#elif defined(__SSE4_1__)
+__m128i expand_bits(unsigned int bits) {
+  const __m128i bytes = _mm_set_epi64x(0x0101010101010101, 0x0000000000000000);
+  const __m128i select = _mm_set1_epi64x(0x8040201008040201);
+
+  return _mm_cmpeq_epi8(_mm_and_si128(_mm_shuffle_epi8(_mm_cvtsi32_si128(bits), bytes), select), select);
+}
+#endif
+
+/* Weight i goes with the outcome i branches ago, taken counts as +1 and
+   not taken as -1 */
+int long_perceptron_output(const signed char *weights, const struct global_history *history, unsigned int length) {
+  unsigned int i;
+  int sum = 0;
+#if defined(__AVX2__)
+  const __m256i twos = _mm256_set1_epi8(2), ones = _mm256_set1_epi8(1), pairs = _mm256_set1_epi16(1);
+  __m256i inputs, products, total = _mm256_setzero_si256();
+  __m128i half;
+
+  for(i = 0; i < length; i += LONG_PERCEPTRON_VECTOR) {
+    inputs = _mm256_sub_epi8(_mm256_and_si256(expand_bits(global_history_window(history, i, LONG_PERCEPTRON_VECTOR)), twos), ones);
+    products = _mm256_sign_epi8(_mm256_loadu_si256((const __m256i *) (weights + i)), inputs);
+    total = _mm256_add_epi32(total, _mm256_madd_epi16(_mm256_maddubs_epi16(ones, products), pairs));
+  }
+
+  half = _mm_add_epi32(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+  half = _mm_hadd_epi32(half, half);
+  sum = _mm_cvtsi128_si32(_mm_hadd_epi32(half, half));
+#elif defined(__SSE4_1__)
+  const __m128i twos = _mm_set1_epi8(2), ones = _mm_set1_epi8(1), pairs = _mm_set1_epi16(1);
+  __m128i inputs, products, total = _mm_setzero_si128();
+
+  for(i = 0; i < length; i += LONG_PERCEPTRON_VECTOR) {
+    inputs = _mm_sub_epi8(_mm_and_si128(expand_bits(global_history_window(history, i, LONG_PERCEPTRON_VECTOR)), twos), ones);
+    products = _mm_sign_epi8(_mm_loadu_si128((const __m128i *) (weights + i)), inputs);
+    total = _mm_add_epi32(total, _mm_madd_epi16(_mm_maddubs_epi16(ones, products), pairs));
+  }
+
+  total = _mm_hadd_epi32(total, total);
+  sum = _mm_cvtsi128_si32(_mm_hadd_epi32(total, total));
+#else
+  for(i = 0; i < length; ++i) {
+    sum += (global_history_bit(history, i)) ? weights[i] : -weights[i];
+  }
+#endif
+
+  return sum;
+}
+
+/* Moves every weight one step towards target * input, saturating. Padding
+   weights past length stay 0 */
+void long_perceptron_train(signed char *weights, const struct global_history *history, unsigned int length, int target) {
+  unsigned int i;
+#if defined(__AVX2__)
+  const __m256i twos = _mm256_set1_epi8(2), ones = _mm256_set1_epi8(1);
+  const __m256i targets = _mm256_set1_epi8(target), minimum = _mm256_set1_epi8(-LONG_PERCEPTRON_WEIGHT_MAX);
+  __m256i steps, updated, valid;
+
+  for(i = 0; i < length; i += LONG_PERCEPTRON_VECTOR) {
+    steps = _mm256_sub_epi8(_mm256_and_si256(expand_bits(global_history_window(history, i, LONG_PERCEPTRON_VECTOR)), twos), ones);
+    valid = expand_bits((length - i >= LONG_PERCEPTRON_VECTOR) ? ~0U : ((1U << (length - i)) - 1));
+    steps = _mm256_and_si256(_mm256_sign_epi8(steps, targets), valid);
+    updated = _mm256_adds_epi8(_mm256_loadu_si256((const __m256i *) (weights + i)), steps);
+    _mm256_storeu_si256((__m256i *) (weights + i), _mm256_max_epi8(updated, minimum));
+  }
+#elif defined(__SSE4_1__)
+  const __m128i twos = _mm_set1_epi8(2), ones = _mm_set1_epi8(1);
+  const __m128i targets = _mm_set1_epi8(target), minimum = _mm_set1_epi8(-LONG_PERCEPTRON_WEIGHT_MAX);
+  __m128i steps, updated, valid;
+
+  for(i = 0; i < length; i += LONG_PERCEPTRON_VECTOR) {
+    steps = _mm_sub_epi8(_mm_and_si128(expand_bits(global_history_window(history, i, LONG_PERCEPTRON_VECTOR)), twos), ones);
+    valid = expand_bits((length - i >= LONG_PERCEPTRON_VECTOR) ? 0xFFFF : ((1U << (length - i)) - 1));
+    steps = _mm_and_si128(_mm_sign_epi8(steps, targets), valid);
+    updated = _mm_adds_epi8(_mm_loadu_si128((const __m128i *) (weights + i)), steps);
+    _mm_storeu_si128((__m128i *) (weights + i), _mm_max_epi8(updated, minimum));
+  }
+#else
+  int weight;
+
+  for(i = 0; i < length; ++i) {
+    weight = weights[i] + ((global_history_bit(history, i)) ? target : -target);
+
+    if(weight >= -LONG_PERCEPTRON_WEIGHT_MAX && weight <= LONG_PERCEPTRON_WEIGHT_MAX) {
+      weights[i] = weight;
+    }
+  }
+#endif
+}
+
+void init_long_perceptron_predictor(struct predictor *predictor) {
+  struct long_perceptron_state *perceptron;
+  unsigned int stride;
+
+  stride = (predictor->history_length + LONG_PERCEPTRON_VECTOR - 1) / LONG_PERCEPTRON_VECTOR * LONG_PERCEPTRON_VECTOR;
+
+  if((perceptron = calloc(1, sizeof(struct long_perceptron_state) + (unsigned long) LONG_PERCEPTRON_ROWS * stride)) == NULL) {
+    fprintf(stderr, "Could not allocate predictor state.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  perceptron->stride = stride;
+
+  /* Training threshold from Jimenez and Lin */
+  perceptron->threshold = (int) (1.93 * predictor->history_length + 14);
+  predictor->state = perceptron;
+}
+
+void long_perceptron_predictor(struct predictor *predictor, unsigned int index, unsigned long address, unsigned long size,
+                               unsigned long next_address, unsigned char *hit) {
+  struct long_perceptron_state *perceptron = predictor->state;
+  unsigned int row = (address ^ (address >> 9)) & (LONG_PERCEPTRON_ROWS - 1);
+  signed char *weights = perceptron->weights + (unsigned long) row * perceptron->stride;
+  signed char *bias = &perceptron->bias[row];
+  unsigned long next_fetch;
+  int output, target;
+
+  output = *bias + long_perceptron_output(weights, &predictor->history, predictor->history_length);
+  next_fetch = (output >= 0) ? (predictor->btb.targets[index]) : (address + size);
+
+  if(next_fetch == next_address) {
+    *hit = 1;
+  } else {
+    *hit = 0;
+  }
+
+  target = (next_address == address + size) ? (-1) : (1);
+
+  if((output >= 0) != (target > 0) || abs(output) <= perceptron->threshold) {
+    long_perceptron_train(weights, &predictor->history, predictor->history_length, target);
+
+    if(*bias + target >= -LONG_PERCEPTRON_WEIGHT_MAX && *bias + target <= LONG_PERCEPTRON_WEIGHT_MAX) {
+      *bias += target;
+    }
+  }
+
+  push_global_history(&predictor->history, target > 0, address);
+}
+
+/* Parses features such as "bias,ghist:0:16,path:0:8/12,local:10,recency:8,loop",
+   where /bits sets the size of the table of a feature */
+void parse_hashed_features(const char *spec, struct hashed_perceptron_state *hashed) {
+  static const char *names[] = { "bias", "ghist", "path", "local", "recency", "loop" };
+  char buf[CHUNK], *feature, *tmp_ptr = NULL, *bits;
+  struct hashed_feature *current;
+  unsigned int i;
+
+  strncpy(buf, spec, sizeof buf - 1);
+  buf[sizeof buf - 1] = '\0';
+  hashed->count = 0;
+
+  for(feature = strtok_r(buf, ",", &tmp_ptr); feature != NULL; feature = strtok_r(NULL, ",", &tmp_ptr)) {
+    if(hashed->count == HASHED_MAX_FEATURES) {
+      fprintf(stderr, "At most %d hashed perceptron features.\n", HASHED_MAX_FEATURES);
+      exit(EXIT_FAILURE);
+    }
+
+    current = &hashed->features[hashed->count++];
+    current->bits = HASHED_TABLE_BITS;
+    current->start = current->end = 0;
+
+    if((bits = strchr(feature, '/')) != NULL) {
+      *bits++ = '\0';
+      current->bits = atoi(bits);
+    }
+
+    for(i = 0; i < sizeof names / sizeof names[0] && strncmp(feature, names[i], strcspn(feature, ":")) != 0; ++i);
+
+    if(i == sizeof names / sizeof names[0] || strlen(names[i]) != strcspn(feature, ":")) {
+      fprintf(stderr, "Unknown hashed perceptron feature: %s\n", feature);
+      exit(EXIT_FAILURE);
+    }
+
+    current->type = i;
+    sscanf(feature + strcspn(feature, ":"), ":%u:%u", &current->start, &current->end);
+
+    if(current->bits < 1 || current->bits > 24 ||
+       ((i == FEATURE_GLOBAL || i == FEATURE_PATH) && current->end <= current->start) ||
+       (i == FEATURE_PATH && current->end > 64) || (i == FEATURE_LOCAL && (current->start < 1 || current->start > 16)) ||
+       (i == FEATURE_RECENCY && (current->start < 1 || current->start > HASHED_MAX_RECENCY)) || current->end > MAX_HISTORY) {
+      fprintf(stderr, "Invalid hashed perceptron feature: %s\n", feature);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+void init_hashed_perceptron_predictor(struct predictor *predictor) {
+  struct hashed_perceptron_state parsed, *hashed;
+  unsigned long storage = 0;
+  unsigned int i, history_length = 1;
+
+  memset(&parsed, 0, sizeof parsed);
+  parse_hashed_features((predictor->config->features != NULL) ? predictor->config->features : HASHED_FEATURES, &parsed);
+
+  for(i = 0; i < parsed.count; ++i) {
+    parsed.features[i].offset = storage;
+    storage += 1UL << parsed.features[i].bits;
+
+    if(parsed.features[i].type == FEATURE_GLOBAL && parsed.features[i].end > history_length) {
+      history_length = parsed.features[i].end;
+    }
+
+    if(parsed.features[i].type == FEATURE_RECENCY && parsed.features[i].start > parsed.recency_length) {
+      parsed.recency_length = parsed.features[i].start;
+    }
+  }
+
+  if((hashed = calloc(1, sizeof(struct hashed_perceptron_state) + storage)) == NULL) {
+    fprintf(stderr, "Could not allocate predictor state.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  memcpy(hashed, &parsed, sizeof parsed);
+  hashed->storage = storage;
+
+  /* Threshold of the hashed perceptron of Tarjan and Skadron */
+  hashed->threshold = (int) (2.14 * (parsed.count + 1) + 20.58);
+
+  /* The features decide how much global history is kept */
+  free(predictor->history.words);
+  predictor->history_length = history_length;
+  init_global_history(&predictor->history, history_length);
+  predictor->state = hashed;
+}
+
+/* Value of a feature for the branch at address, before hashing */
+unsigned long hashed_feature_value(const struct predictor *predictor, const struct hashed_feature *feature, unsigned long address) {
+  const struct hashed_perceptron_state *hashed = predictor->state;
+  unsigned int local = (address ^ (address >> 10)) & (HASHED_LOCAL_ENTRIES - 1), age, length, i;
+  unsigned long value = 0;
+
+  switch(feature->type) {
+    case FEATURE_GLOBAL:
+      /* Longer segments are folded a word at a time */
+      for(age = feature->start; age < feature->end; age += 64) {
+        length = (feature->end - age < 64) ? (feature->end - age) : 64;
+        value = (value << 7 | value >> 57) ^ global_history_window(&predictor->history, age, length);
+      }
+
+      return value;
+    case FEATURE_PATH:
+      return (predictor->history.path >> feature->start) &
+             ((feature->end - feature->start < 64) ? ((1UL << (feature->end - feature->start)) - 1) : ~0UL);
+    case FEATURE_LOCAL:
+      return hashed->local_history[local] & ((1U << feature->start) - 1);
+    case FEATURE_RECENCY:
+      for(i = 0; i < feature->start && i < hashed->recency_length; ++i) {
+        if(hashed->recency[i] == (unsigned short) (address ^ (address >> 16))) {
+          return i + 1;
+        }
+      }
+
+      return 0;
+    case FEATURE_LOOP:
+      return hashed->loop_count[local];
+    default:
+      return 0;
+  }
+}
+
+unsigned long hashed_feature_index(const struct hashed_feature *feature, unsigned long value, unsigned long address, unsigned int number) {
+  unsigned long hash = (value + number) * 0x9E3779B97F4A7C15UL ^ address ^ (address >> feature->bits);
+
+  return (hash ^ (hash >> feature->bits) ^ (hash >> (2 * feature->bits))) & ((1UL << feature->bits) - 1);
+}
+
+void hashed_perceptron_predictor(struct predictor *predictor, unsigned int index, unsigned long address, unsigned long size,
+                                 unsigned long next_address, unsigned char *hit) {
+  struct hashed_perceptron_state *hashed = predictor->state;
+  signed char *weights[HASHED_MAX_FEATURES];
+  unsigned int local = (address ^ (address >> 10)) & (HASHED_LOCAL_ENTRIES - 1), i;
+  unsigned short tag = address ^ (address >> 16);
+  unsigned long next_fetch, value;
+  int output = 0, taken;
+
+  for(i = 0; i < hashed->count; ++i) {
+    value = hashed_feature_value(predictor, &hashed->features[i], address);
+    weights[i] = &hashed->weights[hashed->features[i].offset + hashed_feature_index(&hashed->features[i], value, address, i)];
+    output += *weights[i];
+  }
+
+  next_fetch = (output >= 0) ? (predictor->btb.targets[index]) : (address + size);
+
+  if(next_fetch == next_address) {
+    *hit = 1;
+  } else {
+    *hit = 0;
+  }
+
+  taken = (next_address != address + size);
+
+  if((output >= 0) != taken || abs(output) <= hashed->threshold) {
+    for(i = 0; i < hashed->count; ++i) {
+      if(taken && *weights[i] < HASHED_WEIGHT_MAX) {
+        ++*weights[i];
+      } else if(!taken && *weights[i] > -HASHED_WEIGHT_MAX - 1) {
+        --*weights[i];
+      }
+    }
+  }
+
+  hashed->local_history[local] = (hashed->local_history[local] << 1) | taken;
+  hashed->loop_count[local] = (taken) ? ((hashed->loop_count[local] < 255) ? (hashed->loop_count[local] + 1) : 255) : 0;
+
+  /* Move to front of the recency stack */
+  if(hashed->recency_length > 0) {
+    for(i = 0; i < hashed->recency_length - 1 && hashed->recency[i] != tag; ++i);
+
+    for(; i > 0; --i) {
+      hashed->recency[i] = hashed->recency[i - 1];
+    }
+
+    hashed->recency[0] = tag;
+  }
+
+  push_global_history(&predictor->history, taken, address);
+}
+
+void report_hashed_perceptron(const struct predictor *predictor) {
+  const struct hashed_perceptron_state *hashed = predictor->state;
+
+  /* 6-bit weights */
+  fprintf(stdout, "Hashed Perceptron Features/Weight Storage: %u/%lu bytes\n", hashed->count, hashed->storage * 6 / 8);
+}
+
+static const struct predictor_type predictor_types[] = {
+  { "not_taken",         not_taken_predictor,         0,                       NULL,                             NULL },
+  { "two_bit",           two_bit_predictor,           0,                       NULL,                             NULL },
+  { "two_level_v1",      two_level_predictor,         0,                       init_two_level_predictor,         NULL },
+  { "two_level",         two_level_predictor_v2,      HIST_SIZE,               init_two_level_predictor_v2,      NULL },
+  { "perceptron",        perceptron_predictor,        HIST_SIZE,               init_perceptron_predictor,        NULL },
+  { "tage",              tage_predictor,              TAGE_MAX_HISTORY,        init_tage_predictor,              NULL },
+  { "long_perceptron",   long_perceptron_predictor,   LONG_PERCEPTRON_HISTORY, init_long_perceptron_predictor,   NULL },
+  { "hashed_perceptron", hashed_perceptron_predictor, 0,                       init_hashed_perceptron_predictor, report_hashed_perceptron },
+};
+
+#define PREDICTOR_TYPES      (sizeof predictor_types / sizeof predictor_types[0])
+
+void init_branch_profile(struct branch_profile *profile) {
+  profile->size = PROFILE_INITIAL_ENTRIES;
+  profile->used = 0;
+
+  if((profile->entries = calloc(profile->size, sizeof(struct branch_profile_entry))) == NULL) {
+    fprintf(stderr, "Could not allocate branch profile.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void init_predictor(struct predictor *predictor, const struct predictor_type *type, const struct predictor_config *config) {
+  memset(predictor, 0, sizeof(struct predictor));
+  predictor->type = type;
+  predictor->config = config;
+  init_btb(&predictor->btb, &config->btb);
+  init_return_stack(&predictor->ras, config->ras_entries);
+  init_indirect_predictor(&predictor->indirect);
+  predictor->history_length = (config->history_length > 0 && type->history_length > 0) ? config->history_length : type->history_length;
+  init_global_history(&predictor->history, predictor->history_length);
+
+  if(config->profile_top > 0) {
+    init_branch_profile(&predictor->profile);
+  }
+
+  if(type->init != NULL) {
+    type->init(predictor);
+  }
+}
+
+/* Parses a comma separated list of predictor names, or "all" */
+unsigned int select_predictors(char *list, const struct predictor_type **types) {
+  char *name, *tmp_ptr = NULL;
+  unsigned int count = 0, i;
+
+  if(strcmp(list, "all") == 0) {
+    for(i = 0; i < PREDICTOR_TYPES && i < MAX_PREDICTORS; ++i) {
+      types[count++] = &predictor_types[i];
+    }
+
+    return count;
+  }
+
+  for(name = strtok_r(list, ",", &tmp_ptr); name != NULL; name = strtok_r(NULL, ",", &tmp_ptr)) {
+    for(i = 0; i < PREDICTOR_TYPES && strcmp(predictor_types[i].name, name) != 0; ++i);
+
+    if(i == PREDICTOR_TYPES) {
+      fprintf(stderr, "Unknown predictor: %s\n", name);
+      exit(EXIT_FAILURE);
+    }
+
+    if(count == MAX_PREDICTORS) {
+      fprintf(stderr, "At most %d predictors per run.\n", MAX_PREDICTORS);
+      exit(EXIT_FAILURE);
+    }
+
+    types[count++] = &predictor_types[i];
+  }
+
+  return count;
+}
+
+struct branch_profile_entry *branch_profile_find(struct branch_profile *profile, unsigned long address) {
+  struct branch_profile_entry *entries;
+  unsigned long i, j, size;
+
+  i = ((address + 1) * 0x9E3779B97F4A7C15UL) & (profile->size - 1);
+
+  while(profile->entries[i].address != 0 && profile->entries[i].address != address + 1) {
+    i = (i + 1) & (profile->size - 1);
+  }
+
+  if(profile->entries[i].address != 0) {
+    return &profile->entries[i];
+  }
+
+  /* Keep the map at most half full, doubling it before inserting */
+  if(2 * (profile->used + 1) > profile->size) {
+    entries = profile->entries;
+    size = profile->size;
+
+    profile->size *= 2;
+    profile->used = 0;
+
+    if((profile->entries = calloc(profile->size, sizeof(struct branch_profile_entry))) == NULL) {
+      fprintf(stderr, "Could not allocate branch profile.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    for(j = 0; j < size; ++j) {
+      if(entries[j].address != 0) {
+        *branch_profile_find(profile, entries[j].address - 1) = entries[j];
+      }
+    }
+
+    free(entries);
+    return branch_profile_find(profile, address);
+  }
+
+  profile->entries[i].address = address + 1;
+  ++profile->used;
+  return &profile->entries[i];
+}
+
+void profile_branch(struct branch_profile *profile, unsigned long address, unsigned int taken, unsigned int btb_miss,
+                    unsigned int mispredicted) {
+  struct branch_profile_entry *entry = branch_profile_find(profile, address);
+
+  if(entry->executions > 0 && entry->last_taken != taken) {
+    ++entry->transitions;
+  }
+
+  ++entry->executions;
+  entry->taken += taken;
+  entry->btb_misses += btb_miss;
+  entry->mispredictions += mispredicted;
+  entry->last_taken = taken;
+}
+
+/* Hardest to predict first: most mispredictions, then most executions */
+int compare_profiled_branches(const void *a, const void *b) {
+  const struct branch_profile_entry *x = a, *y = b;
+
+  if(x->mispredictions != y->mispredictions) {
+    return (x->mispredictions < y->mispredictions) ? 1 : -1;
+  }
+
+  return (x->executions < y->executions) ? 1 : ((x->executions > y->executions) ? -1 : 0);
+}
+
+/* Sorts the profile in place, it is only reported at the end of the run */
+void print_branch_profile(struct predictor *predictor, unsigned int top) {
+  struct branch_profile *profile = &predictor->profile;
+  struct branch_profile_entry *entry;
+  unsigned long i, n = 0, covered = 0;
+
+  for(i = 0; i < profile->size; ++i) {
+    if(profile->entries[i].address != 0) {
+      profile->entries[n++] = profile->entries[i];
+    }
+  }
+
+  qsort(profile->entries, n, sizeof(struct branch_profile_entry), compare_profiled_branches);
+
+  fprintf(stdout, "Profiled Branches (%s): %lu\n", predictor->type->name, n);
+
+  for(i = 0; i < n && i < top; ++i) {
+    entry = &profile->entries[i];
+    covered += entry->mispredictions;
+    fprintf(stdout, "Branch 0x%lx Executions/Taken/Mispredictions/BTB Misses/Transitions: %lu/%.1f%%/%lu (%.1f%%, %.1f%% cumulative)/%lu/%.1f%%\n",
+            entry->address - 1, entry->executions, 100.0 * entry->taken / entry->executions, entry->mispredictions,
+            (predictor->acum_miss_pred > 0) ? (100.0 * entry->mispredictions / predictor->acum_miss_pred) : 0.0,
+            (predictor->acum_miss_pred > 0) ? (100.0 * covered / predictor->acum_miss_pred) : 0.0, entry->btb_misses,
+            (entry->executions > 1) ? (100.0 * entry->transitions / (entry->executions - 1)) : 0.0);
+  }
+}
+
+void simulate_branch(struct predictor *predictor, unsigned int kind, unsigned long address, unsigned long size,
+                     unsigned long next_address) {
+  unsigned long return_address = 0;
+  unsigned int added_recently = 0;
+  unsigned char hit = 1;
+  int index;
+
+  if(kind == BRANCH_RETURN && predictor->ras.size > 0) {
+    return_address = pop_return_stack(&predictor->ras);
+  } else if(kind == BRANCH_CALL && predictor->ras.size > 0) {
+    push_return_stack(&predictor->ras, address + size);
+  }
+
+  if((index = btb_lookup(&predictor->btb, address)) < 0) {
+    index = btb_insert(&predictor->btb, address);
+
+    if(next_address != address + size) {
+      ++predictor->acum_miss;
+    } else {
+      ++predictor->acum_hit;
+    }
+
+    added_recently = 1;
+  }
+
+  if(added_recently == 0) {
+    if(kind == BRANCH_CONDITIONAL) {
+      SELF_PROFILE_ENTER(SELF_PREDICTOR);
+      predictor->type->predict(predictor, index, address, size, next_address, &hit);
+      SELF_PROFILE_LEAVE();
+    } else if(kind == BRANCH_RETURN && predictor->ras.size > 0) {
+      hit = (return_address == next_address);
+
+      if(hit == 1) {
+        ++predictor->ras.hits;
+      } else {
+        ++predictor->ras.misses;
+      }
+    } else if(predictor->btb.indirect[index] != 0) {
+      hit = (predict_indirect(&predictor->indirect, address, predictor->btb.targets[index], next_address) == next_address);
+    } else if(predictor->btb.targets[index] == next_address) {
+      hit = 1;
+    } else {
+      /* A second target, from now on it goes to the indirect predictor */
+      predictor->btb.indirect[index] = 1;
+      predict_indirect(&predictor->indirect, address, predictor->btb.targets[index], next_address);
+      hit = 0;
+    }
+
+    if(hit == 1) {
+      ++predictor->acum_hit;
+    } else {
+      ++predictor->acum_miss_pred;
+    }
+  }
+
+  if(predictor->profile.entries != NULL) {
+    profile_branch(&predictor->profile, address, next_address != address + size, added_recently, hit == 0);
+  }
+
+  if(kind == BRANCH_CONDITIONAL) {
+    push_global_history(&predictor->indirect.history, next_address != address + size, address);
+  }
+
+  if(next_address != address + size) {
+    predictor->btb.targets[index] = next_address;
+  }
+}
+
+void free_predictor(struct predictor *predictor) {
+  free(predictor->state);
+  free(predictor->history.words);
+  free_btb(&predictor->btb);
+  free_indirect_predictor(&predictor->indirect);
+  free(predictor->ras.entries);
+  free(predictor->profile.entries);
+}
+
+/* Feeds every branch of the trace to all predictors, returns the cycles of
+   the other instructions, one each */
+unsigned long simulate_trace(const char *trace, struct predictor *predictors, unsigned int count, unsigned long *records) {
+  struct trace_reader reader;
+  struct branch_record branch;
+  unsigned long cycles = 0;
+  unsigned int i;
+
+  open_trace(&reader, trace);
+
+  while(read_branch(&reader, &branch)) {
+    SELF_PROFILE_RECORD();
+    cycles += branch.run;
+
+    for(i = 0; i < count; ++i) {
+      simulate_branch(&predictors[i], branch.kind, branch.address, branch.size, branch.next_address);
+    }
+  }
+
+  SELF_PROFILE_SWITCH(SELF_OTHER);
+  close_trace(&reader);
+  *records = reader.records;
+  return cycles + reader.tail;
+}
+
+unsigned long predictor_cycles(const struct predictor *predictor, unsigned long cycles) {
+  return cycles + (predictor->acum_miss * BTB_MISS) + (predictor->acum_hit * BTB_HIT) +
+         (predictor->acum_miss_pred * BTB_MISS_PREDICTED) + (predictor->btb.l1_hits * BTB_L1_LATENCY);
+}
+
+/* One column per predictor */
+void print_report(const struct predictor *predictors, unsigned int count, unsigned long cycles) {
+  unsigned int i;
+
+  fprintf(stdout, "%-16s", "Predictor:");
+  for(i = 0; i < count; ++i) fprintf(stdout, " %18s", predictors[i].type->name);
+  fprintf(stdout, "\n%-16s", "Cycles:");
+  for(i = 0; i < count; ++i) fprintf(stdout, " %18lu", predictor_cycles(&predictors[i], cycles));
+  fprintf(stdout, "\n%-16s", "Acum_hit:");
+  for(i = 0; i < count; ++i) fprintf(stdout, " %18lu", predictors[i].acum_hit);
+  fprintf(stdout, "\n%-16s", "Acum_miss:");
+  for(i = 0; i < count; ++i) fprintf(stdout, " %18lu", predictors[i].acum_miss);
+  fprintf(stdout, "\n%-16s", "Acum_miss_pred:");
+  for(i = 0; i < count; ++i) fprintf(stdout, " %18lu", predictors[i].acum_miss_pred);
+  fprintf(stdout, "\n");
+
+  if(predictors[0].ras.hits + predictors[0].ras.misses > 0) {
+    fprintf(stdout, "%-16s", "Ras_hit:");
+    for(i = 0; i < count; ++i) fprintf(stdout, " %18lu", predictors[i].ras.hits);
+    fprintf(stdout, "\n%-16s", "Ras_miss:");
+    for(i = 0; i < count; ++i) fprintf(stdout, " %18lu", predictors[i].ras.misses);
+    fprintf(stdout, "\n%-16s", "Ras_overflow:");
+    for(i = 0; i < count; ++i) fprintf(stdout, " %18lu", predictors[i].ras.overflows);
+    fprintf(stdout, "\n");
+  }
+
+  if(predictors[0].indirect.hits + predictors[0].indirect.misses > 0) {
+    fprintf(stdout, "%-16s", "Indirect_hit:");
+    for(i = 0; i < count; ++i) fprintf(stdout, " %18lu", predictors[i].indirect.hits);
+    fprintf(stdout, "\n%-16s", "Indirect_miss:");
+    for(i = 0; i < count; ++i) fprintf(stdout, " %18lu", predictors[i].indirect.misses);
+    fprintf(stdout, "\n");
+  }
+
+  if(predictors[0].btb.l0_entries > 0) {
+    fprintf(stdout, "%-16s", "BTB_l0_hit:");
+    for(i = 0; i < count; ++i) fprintf(stdout, " %18lu", predictors[i].btb.l0_hits);
+    fprintf(stdout, "\n%-16s", "BTB_l1_hit:");
+    for(i = 0; i < count; ++i) fprintf(stdout, " %18lu", predictors[i].btb.l1_hits);
+    fprintf(stdout, "\n");
+  }
+}
+
+/* Adds path to the batch, or every file in it when it is a directory */
+void add_batch_trace(struct batch *batch, const char *path) {
+  char file[BATCH_PATH_SIZE];
+  struct dirent *entry;
+  struct stat status;
+  DIR *directory;
+
+  if(stat(path, &status) != 0) {
+    fprintf(stderr, "Could not open %s.\n", path);
+    exit(1);
+  }
+
+  if(S_ISDIR(status.st_mode)) {
+    if((directory = opendir(path)) == NULL) {
+      fprintf(stderr, "Could not open %s.\n", path);
+      exit(1);
+    }
+
+    while((entry = readdir(directory)) != NULL) {
+      snprintf(file, sizeof file, "%s/%s", path, entry->d_name);
+
+      if(entry->d_name[0] != '.' && stat(file, &status) == 0 && S_ISREG(status.st_mode)) {
+        add_batch_trace(batch, file);
+      }
+    }
+
+    closedir(directory);
+    return;
+  }
+
+  if((batch->traces = realloc(batch->traces, (batch->count + 1) * sizeof(struct batch_trace))) == NULL) {
+    fprintf(stderr, "Could not allocate batch.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  memset(&batch->traces[batch->count], 0, sizeof(struct batch_trace));
+  batch->traces[batch->count].path = strdup(path);
+  batch->traces[batch->count].size = status.st_size;
+  ++batch->count;
+}
+
+int compare_batch_paths(const void *a, const void *b) {
+  return strcmp(((const struct batch_trace *) a)->path, ((const struct batch_trace *) b)->path);
+}
+
+int compare_batch_sizes(const void *a, const void *b) {
+  unsigned long size_a = (*(struct batch_trace * const *) a)->size, size_b = (*(struct batch_trace * const *) b)->size;
+
+  return (size_a < size_b) - (size_a > size_b);
+}
+
+/* Each thread has its own predictor instances, nothing else is shared */
+void *batch_worker(void *argument) {
+  struct batch *batch = argument;
+  struct predictor predictors[MAX_PREDICTORS];
+  struct batch_trace *trace;
+  unsigned long cycles;
+  unsigned int next, i;
+
+  while((next = __sync_fetch_and_add(&batch->next, 1)) < batch->count) {
+    trace = batch->order[next];
+
+    for(i = 0; i < batch->predictors; ++i) {
+      init_predictor(&predictors[i], batch->types[i], batch->config);
+    }
+
+    cycles = simulate_trace(trace->path, predictors, batch->predictors, &trace->records);
+
+    for(i = 0; i < batch->predictors; ++i) {
+      trace->cycles[i] = predictor_cycles(&predictors[i], cycles);
+      trace->miss_pred[i] = predictors[i].acum_miss_pred;
+      free_predictor(&predictors[i]);
+    }
+  }
+
+  return NULL;
+}
+
+double batch_mpki(const struct batch_trace *trace, unsigned int i) {
+  return (trace->records > 0) ? (1000.0 * trace->miss_pred[i] / trace->records) : 0.0;
+}
+
+/* Speedups are over the first predictor */
+void print_batch_report(const struct batch *batch, unsigned int threads) {
+  const char *name;
+  double mean, log_speedup;
+  unsigned int width = 16, t, i;
+
+  for(t = 0; t < batch->count; ++t) {
+    name = (strrchr(batch->traces[t].path, '/') != NULL) ? (strrchr(batch->traces[t].path, '/') + 1) : batch->traces[t].path;
+    width = (strlen(name) + 1 > width) ? (strlen(name) + 1) : width;
+  }
+
+  fprintf(stdout, "Batch Traces/Threads: %u/%u\n", batch->count, threads);
+  fprintf(stdout, "%-*s", width, "Predictor:");
+  for(i = 0; i < batch->predictors; ++i) fprintf(stdout, " %18s", batch->types[i]->name);
+  fprintf(stdout, "\n");
+
+  for(t = 0; t < batch->count; ++t) {
+    name = (strrchr(batch->traces[t].path, '/') != NULL) ? (strrchr(batch->traces[t].path, '/') + 1) : batch->traces[t].path;
+    fprintf(stdout, "%s:%*s", name, (int) (width - strlen(name) - 1), "");
+    for(i = 0; i < batch->predictors; ++i) fprintf(stdout, " %13.3f MPKI", batch_mpki(&batch->traces[t], i));
+    fprintf(stdout, "\n%-*s", width, "");
+    for(i = 0; i < batch->predictors; ++i) fprintf(stdout, " %17.3fx", (double) batch->traces[t].cycles[0] / batch->traces[t].cycles[i]);
+    fprintf(stdout, "\n");
+  }
+
+  fprintf(stdout, "%-*s", width, "Mean MPKI:");
+
+  for(i = 0; i < batch->predictors; ++i) {
+    for(t = 0, mean = 0.0; t < batch->count; ++t) {
+      mean += batch_mpki(&batch->traces[t], i) / batch->count;
+    }
+
+    fprintf(stdout, " %18.3f", mean);
+  }
+
+  fprintf(stdout, "\n%-*s", width, "Geomean speedup:");
+
+  for(i = 0; i < batch->predictors; ++i) {
+    for(t = 0, log_speedup = 0.0; t < batch->count; ++t) {
+      log_speedup += log((double) batch->traces[t].cycles[0] / batch->traces[t].cycles[i]) / batch->count;
+    }
+
+    fprintf(stdout, " %17.3fx", exp(log_speedup));
+  }
+
+  fprintf(stdout, "\n");
+}
+
+/* Runs every trace over a pool of threads */
+void run_batch(char *const *paths, unsigned int count, const struct predictor_type **types, unsigned int predictors,
+               const struct predictor_config *config, unsigned int threads) {
+  struct batch batch;
+  pthread_t *pool;
+  unsigned int i;
+
+  memset(&batch, 0, sizeof batch);
+  batch.types = types;
+  batch.predictors = predictors;
+  batch.config = config;
+
+  for(i = 0; i < count; ++i) {
+    add_batch_trace(&batch, paths[i]);
+  }
+
+  if(batch.count == 0) {
+    fprintf(stderr, "No traces to run.\n");
+    exit(1);
+  }
+
+  /* Reported by name, run largest first so no thread is left with a big
+     trace at the end */
+  qsort(batch.traces, batch.count, sizeof(struct batch_trace), compare_batch_paths);
+  batch.order = malloc(batch.count * sizeof(struct batch_trace *));
+  pool = malloc(threads * sizeof(pthread_t));
+
+  if(batch.order == NULL || pool == NULL) {
+    fprintf(stderr, "Could not allocate batch.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for(i = 0; i < batch.count; ++i) {
+    batch.order[i] = &batch.traces[i];
+  }
+
+  qsort(batch.order, batch.count, sizeof(struct batch_trace *), compare_batch_sizes);
+  threads = (threads > batch.count) ? batch.count : threads;
+
+  for(i = 0; i < threads; ++i) {
+    if(pthread_create(&pool[i], NULL, batch_worker, &batch) != 0) {
+      fprintf(stderr, "Could not start thread.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for(i = 0; i < threads; ++i) {
+    pthread_join(pool[i], NULL);
+  }
+
+  print_batch_report(&batch, threads);
+
+  for(i = 0; i < batch.count; ++i) {
+    free(batch.traces[i].path);
+  }
+
+  free(batch.traces);
+  free(batch.order);
+  free(pool);
+}
+
+int main(int argc, char *const *argv) {
+  unsigned long cycles, records;
+  unsigned int count = 0, i, threads = 0;
+  const char *compact_output = NULL;
+  struct run_config run;
+  struct predictor_config config = { 0, NULL, { BTB_SIZE, BTB_WAYS, BTB_TAG_BITS, BTB_LRU, 0 }, RAS_ENTRIES, 0 };
+  struct predictor predictors[MAX_PREDICTORS];
+  const struct predictor_type *types[MAX_PREDICTORS];
+  struct stat status;
+  int opt;
+
+  while((opt = getopt(argc, argv, "p:g:m:b:r:c:j:P:")) != -1) {
+    switch(opt) {
+      case 'p':
+        count = select_predictors(optarg, types);
+        break;
+      case 'g':
+        config.history_length = atoi(optarg);
+
+        if(config.history_length < 1 || config.history_length > MAX_HISTORY) {
+          fprintf(stderr, "Global history length must be between 1 and %d.\n", MAX_HISTORY);
+          exit(EXIT_FAILURE);
+        }
+
+        break;
+      case 'm':
+        config.features = optarg;
+        break;
+      case 'b':
+        parse_btb_config(optarg, &config.btb);
+        break;
+      case 'r':
+        if(atoi(optarg) < 0 || atoi(optarg) > MAX_RAS_ENTRIES) {
+          fprintf(stderr, "RAS entries must be between 0 and %d.\n", MAX_RAS_ENTRIES);
+          exit(EXIT_FAILURE);
+        }
+
+        config.ras_entries = atoi(optarg);
+        break;
+      case 'c':
+        compact_output = optarg;
+        break;
+      case 'j':
+        if(atoi(optarg) < 1 || atoi(optarg) > MAX_THREADS) {
+          fprintf(stderr, "Threads must be between 1 and %d.\n", MAX_THREADS);
+          exit(EXIT_FAILURE);
+        }
+
+        threads = atoi(optarg);
+        break;
+      case 'P':
+        if(atoi(optarg) < 1) {
+          fprintf(stderr, "The profile needs at least one branch.\n");
+          exit(EXIT_FAILURE);
+        }
+
+        config.profile_top = atoi(optarg);
+        break;
+      default:
+        fprintf(stdout, "Uso: %s [-p predictor[,predictor...]|all] [-g history length] [-m features] [-b entries[,ways[,tag bits[,lru|fifo|random[,L0 entries]]]]] [-r RAS entries] [-c compact trace output] [-j threads] [-P top branches] <trace file|directory>...\n", argv[0]);
+        exit(0);
+    }
+  }
+
+  if(optind >= argc) {
+    fprintf(stdout, "Uso: %s [-p predictor[,predictor...]|all] [-g history length] [-m features] [-b entries[,ways[,tag bits[,lru|fifo|random[,L0 entries]]]]] [-r RAS entries] [-c compact trace output] [-j threads] [-P top branches] <trace file|directory>...\n", argv[0]);
+    exit(0);
+  }
+
+  if(compact_output != NULL) {
+    convert_trace(argv[optind], compact_output);
+    return 0;
+  }
+
+  /* Without -p, the predictor this binary was built for */
+  for(i = 0; count == 0 && i < PREDICTOR_TYPES; ++i) {
+    if(predictor_types[i].predict == BRANCH_PREDICTOR) {
+      types[count++] = &predictor_types[i];
+    }
+  }
+
+  /* Several traces or a directory, the profile and the results store
+     only cover single runs */
+  if(optind + 1 < argc || threads > 0 || (stat(argv[optind], &status) == 0 && S_ISDIR(status.st_mode))) {
+    config.profile_top = 0;
+    run_batch(argv + optind, argc - optind, types, count, &config,
+              (threads > 0) ? threads : (unsigned int) sysconf(_SC_NPROCESSORS_ONLN));
+    return 0;
+  }
+
+  for(i = 0; i < count; ++i) {
+    init_predictor(&predictors[i], types[i], &config);
+  }
+
+  /* Profiled runs are not memoized */
+  self_profile_init();
+
+  memset(&run, 0, sizeof run);
+  run.btb = config.btb;
+  run.ras_entries = config.ras_entries;
+  run.profile_top = config.profile_top;
+
+  for(i = 0; i < count; ++i) {
+    strncpy(run.names[i], types[i]->name, sizeof run.names[i] - 1);
+    run.history_lengths[i] = predictors[i].history_length;
+
+    if(types[i]->init == init_hashed_perceptron_predictor) {
+      memcpy(run.features, ((struct hashed_perceptron_state *) predictors[i].state)->features, sizeof run.features);
+    }
+  }
+
+  if(self_profiling == 0 && results_store_open(argv[optind], argv[0], &run, sizeof run) != 0) {
+    return 0;
+  }
+
+  /* The trace is decoded once and every branch is fed to all predictors */
+  cycles = simulate_trace(argv[optind], predictors, count, &records);
+
+  if(count == 1) {
+    fprintf(stdout, "Cycles: %lu\nAcum_hit: %ld\nAcum_miss: %ld\nAcum_miss_pred: %ld\n", predictor_cycles(&predictors[0], cycles),
+            predictors[0].acum_hit, predictors[0].acum_miss, predictors[0].acum_miss_pred);
+
+    if(predictors[0].ras.hits + predictors[0].ras.misses > 0) {
+      fprintf(stdout, "Ras_hit: %lu\nRas_miss: %lu\nRas_overflow: %lu\n", predictors[0].ras.hits, predictors[0].ras.misses,
+              predictors[0].ras.overflows);
+    }
+
+    if(predictors[0].indirect.hits + predictors[0].indirect.misses > 0) {
+      fprintf(stdout, "Indirect_hit: %lu\nIndirect_miss: %lu\n", predictors[0].indirect.hits, predictors[0].indirect.misses);
+    }
+
+    if(predictors[0].btb.l0_entries > 0) {
+      fprintf(stdout, "BTB_l0_hit: %lu\nBTB_l1_hit: %lu\n", predictors[0].btb.l0_hits, predictors[0].btb.l1_hits);
+    }
+  } else {
+    print_report(predictors, count, cycles);
+  }
+
+  for(i = 0; i < count; ++i) {
+    if(predictors[i].type->report != NULL) {
+      predictors[i].type->report(&predictors[i]);
+    }
+
+    if(config.profile_top > 0) {
+      print_branch_profile(&predictors[i], config.profile_top);
+    }
+  }
 
-    address = next_address;
-    size = next_size;
-    is_cond = next_is_cond;
+  for(i = 0; i < count; ++i) {
+    free_predictor(&predictors[i]);
   }
 
-  cycles += (acum_miss * BTB_MISS) + (acum_hit * BTB_HIT) + (acum_miss_pred * BTB_MISS_PREDICTED);
-  fprintf(stdout, "Cycles: %lu\nAcum_hit: %ld\nAcum_miss: %ld\nAcum_miss_pred: %ld\n", cycles, acum_hit, acum_miss, acum_miss_pred);
+  self_profile_report(records);
+  results_store_close();
   return 0;
 }
@@ -24,6 +24,10 @@
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <math.h>
+#include "results_store.h"
+#include "trace_index.h"
+#include "self_profile.h"
 
 /* Number of bytes to read at a time */
 #define CHUNK                       1024
@@ -34,12 +38,68 @@
 #define L1_BLOCK_SIZE               64
 #define L1_LATENCY                  2
 
+/* L1 instruction cache parameters */
+#define L1I_SIZE                    (32 * 1024)
+#define L1I_WAYS                    8
+#define L1I_BLOCK_SIZE              64
+#define L1I_SETS                    (L1I_SIZE / (L1I_BLOCK_SIZE * L1I_WAYS))
+
 /* L2 cache parameters */
-#define L2_SIZE                     (2 * 1024 * 1024)
-#define L2_WAYS                     8
+#ifndef L2_SIZE
+#  define L2_SIZE                   (2 * 1024 * 1024)
+#endif
+
+#ifndef L2_WAYS
+#  define L2_WAYS                   8
+#endif
+
 #define L2_BLOCK_SIZE               64
 #define L2_LATENCY                  4
 
+/* L2 sectors, one tag for L2_SECTOR_BLOCKS consecutive blocks (at most 16) */
+#ifndef L2_SECTOR_BLOCKS
+#  define L2_SECTOR_BLOCKS          1
+#endif
+
+#if L2_SECTOR_BLOCKS < 1 || L2_SECTOR_BLOCKS > 16
+#  error "L2_SECTOR_BLOCKS must be between 1 and 16"
+#endif
+
+#define L2_SECTOR_SIZE              (L2_BLOCK_SIZE * L2_SECTOR_BLOCKS)
+#define L2_SETS                     (L2_SIZE / (L2_SECTOR_SIZE * L2_WAYS))
+#define L2_BLOCK(address)           (((address) / L2_BLOCK_SIZE) % L2_SECTOR_BLOCKS)
+#define L2_BLOCK_BIT(address)       (1U << L2_BLOCK(address))
+
+/* Set sampling, only sets whose low index bits are all zero are simulated */
+#define L2_SAMPLED(address)         ((((address) / L2_SECTOR_SIZE) & l2_sample_mask) == 0)
+#define L2_SAMPLED_SET(address)     (((address) / L2_SECTOR_SIZE) % L2_SETS >> l2_sample_shift)
+
+/* Miss status holding registers per level */
+#define L1_MSHRS                    10
+#define L2_MSHRS                    32
+
+/* Coalescing write buffer between L1 and L2 */
+#define WRITE_BUFFER_DEPTH          8
+
+/* Out-of-order window defaults (used with -o) */
+#define ROB_SIZE                    128
+#define ISSUE_WIDTH                 4
+
+/* Data TLB parameters, x86-64 style 4-level page table */
+#define DTLB_ENTRIES                64
+#define DTLB_HUGE_ENTRIES           32
+#define DTLB_WAYS                   4
+#define STLB_ENTRIES                1536
+#define STLB_WAYS                   12
+#define STLB_LATENCY                7
+#define PWC_ENTRIES                 32 /* Per upper page table level */
+#define PAGE_TABLE_LEVELS           4
+#define PAGE_TABLE_INDEX_BITS       9
+#define PAGE_TABLE_FRAMES           (1UL << 20)
+#define PAGE_TABLE_BASE             0xFFFF800000000000UL
+#define SMALL_PAGE_SHIFT            12
+#define HUGE_PAGE_SHIFT             21
+
 /* Fetch return codes */
 #define FETCH_HIT                   1
 #define FETCH_MISS                  2
@@ -47,9 +107,41 @@
 /* DRAM latency */
 #define DRAM_LATENCY                150
 
+/* Banked DRAM model defaults (timings in core cycles, 2GHz core, DDR3-1600) */
+#define DRAM_CHANNELS               2
+#define DRAM_RANKS                  1
+#define DRAM_BANKS                  8
+#define DRAM_ROW_SIZE               (8 * 1024)
+#define DRAM_TRCD                   28
+#define DRAM_TCAS                   28
+#define DRAM_TRP                    28
+#define DRAM_TBURST                 10
+#define DRAM_CONTROLLER_LATENCY     70
+#define DRAM_QUEUE_SIZE             32
+
+/* DRAM request types */
+#define DRAM_DEMAND                 0
+#define DRAM_PREFETCH               1
+#define DRAM_WRITE                  2
+
+/* DRAM row buffer policies */
+#define DRAM_OPEN_ROW               0
+#define DRAM_CLOSED_ROW             1
+
 /* PC based stride prefetcher table lines */
 #define STRIDE_PREFETCHER_ENTRIES   64
 
+/* Instruction prefetchers */
+#define IPREFETCH_DISABLED          0 /* No instruction cache simulation */
+#define IPREFETCH_NONE              1
+#define IPREFETCH_NEXT_LINE         2
+#define IPREFETCH_FETCH_DIRECTED    3
+
+/* Instruction prefetcher parameters */
+#define NEXT_LINE_DEGREE            2
+#define FDIP_SUCCESSOR_ENTRIES      512
+#define FDIP_LOOKAHEAD              4
+
 /* Stride prefetcher states */
 #define STATE_INIT                  0
 #define STATE_TRANSIENT             1
@@ -62,6 +154,93 @@
 #define DELTA_PREDICTION_TABLES     3
 #define PREDICTION_TABLE_LENGTH     64
 
+/* Best-Offset prefetcher parameters */
+#define BO_MAX_OFFSETS              64
+#define BO_RR_ENTRIES               256
+#define BO_SCORE_MAX                31
+#define BO_ROUND_MAX                100
+#define BO_BAD_SCORE                1
+
+/* Signature Path Prefetcher parameters */
+#define SPP_SIGNATURE_TABLE_ENTRIES 256
+#define SPP_PATTERN_TABLE_ENTRIES   512
+#define SPP_PATTERN_DELTAS          4
+#define SPP_SIGNATURE_BITS          12
+#define SPP_COUNTER_MAX             15
+#define SPP_PREFETCH_THRESHOLD      25 /* Percent */
+#define SPP_LOOKAHEAD_THRESHOLD     50 /* Percent */
+#define SPP_MAX_DEPTH               8
+
+/* Stream buffer prefetcher parameters */
+#define STREAM_BUFFERS              8
+#define STREAM_BUFFER_DEPTH         4
+#define STREAM_WINDOW               16
+
+/* Stream buffer states */
+#define STREAM_INVALID              0
+#define STREAM_TRAINING             1
+#define STREAM_ACTIVE               2
+
+/* Default prefetch degree and distance (in prefetcher steps) */
+#ifndef PREFETCH_DEGREE
+#  define PREFETCH_DEGREE           1
+#endif
+
+#ifndef PREFETCH_DISTANCE
+#  define PREFETCH_DISTANCE         1
+#endif
+
+#define PREFETCH_MAX                64   /* Largest degree and distance taken by -d/-D */
+
+/* Feedback directed prefetch throttling parameters */
+#define FDP_INTERVAL                1024 /* L2 demand misses */
+#define FDP_LEVELS                  6
+#define FDP_INITIAL_LEVEL           3
+#define FDP_ACCURACY_HIGH           75   /* Percent */
+#define FDP_ACCURACY_LOW            40   /* Percent */
+#define FDP_LATENESS_THRESHOLD      10   /* Percent of useful prefetches */
+#define FDP_POLLUTION_THRESHOLD     5    /* Percent of demand misses */
+#define FDP_POLLUTION_FILTER_BITS   4096
+#define FDP_MAX_BACKOFF             64   /* Most intervals off before probing again */
+
+/* L1-filtered trace record types */
+#define FILTERED_L1_MISS            0
+#define FILTERED_L1_WRITEBACK       1 /* Dirty eviction or write-through store */
+#define FILTERED_L1I_MISS           2
+#define FILTERED_L1I_PREFETCH       3
+#define FILTERED_L1_WALK_MISS       4 /* Page table entry read by a page walk */
+#define FILTERED_TRACE_MAGIC        "L1FT"
+
+/* Bumped on every header or record layout change. Files from before
+   there was a version hold the L1 size there and are rejected too */
+#define FILTERED_TRACE_VERSION      4
+
+/* Latency histograms, log bucketed with 2^LATENCY_SUB_BUCKET_BITS linear
+   sub-buckets per power of two as in HDR histograms */
+#define LATENCY_SUB_BUCKET_BITS     4
+#define LATENCY_BUCKETS             ((64 - LATENCY_SUB_BUCKET_BITS + 1) << LATENCY_SUB_BUCKET_BITS)
+
+/* Latency histogram classes, by access type and by the level serving it */
+#define LATENCY_LOAD                0
+#define LATENCY_STORE               1
+#define LATENCY_PREFETCH_HIT        2 /* Demand access to a prefetched L2 line */
+#define LATENCY_L1                  3
+#define LATENCY_L2                  4
+#define LATENCY_MEMORY              5
+#define LATENCY_CLASSES             6
+
+/* Trace fields, see get_opcode() */
+#define TRACE_OPCODE_FIELD          2
+#define TRACE_ADDRESS_FIELDS        ((1U << 3) | (1U << 4) | (1U << 5))
+
+/* Region profiler defaults */
+#define PROFILE_TOP_REGIONS         10
+#define PROFILE_INITIAL_ENTRIES     1024    /* Power of two */
+#define PROFILE_INTERVAL            1000000 /* Cycles per heatmap row */
+
+/* Lines per page (used by page-bounded prefetchers) */
+#define PAGE_LINES                  (PAGE_SIZE / L2_BLOCK_SIZE)
+
 /* Invalid predictor (convention) */
 #define INVALID_PREDICTOR           (9999)
 
@@ -87,6 +266,16 @@ struct cache_entry {
   int prefetched;
 };
 
+/* Sub-block state is kept as bit masks, one bit per block of the sector */
+struct sector_entry {
+  unsigned long tag;
+  unsigned long cycle;        /* Latest fill arrival, also used for replacement */
+  unsigned long ready[L2_SECTOR_BLOCKS]; /* Arrival of each block */
+  unsigned short valid;
+  unsigned short dirty;
+  unsigned short prefetched;
+};
+
 struct reference_prediction_entry {
   unsigned long tag;
   unsigned long last_address;
@@ -119,10 +308,231 @@ struct delta_prediction_table_entry {
   int nmru;
 };
 
+struct signature_table_entry {
+  unsigned long page_number;
+  unsigned int last_offset;
+  unsigned int signature;
+  int valid;
+};
+
+struct pattern_table_entry {
+  int deltas[SPP_PATTERN_DELTAS];
+  unsigned int delta_counters[SPP_PATTERN_DELTAS];
+  unsigned int signature_counter;
+};
+
+struct stream_buffer_entry {
+  unsigned long last_line;
+  unsigned long next_line;
+  unsigned long cycle;
+  int direction;
+  unsigned char state; /* Invalid - Training - Active */
+};
+
+/* L1-filtered trace, records only what reaches L2 */
+struct filtered_trace_header {
+  char magic[4];
+  unsigned int version;
+  unsigned int l1_size;
+  unsigned int l1_ways;
+  unsigned int l1_block_size;
+  unsigned long records;
+  unsigned long l1_hit;
+  unsigned long l1_miss;
+  unsigned long l1_writebacks;
+  unsigned long l1i_hit;
+  unsigned long l1i_miss;
+  unsigned long l1i_useful_prefetches;
+  unsigned long l1i_total_prefetches;
+  unsigned long tail_cycles;
+  unsigned long page_shift;
+  unsigned long dtlb_hits;
+  unsigned long dtlb_misses;
+  unsigned long stlb_hits;
+  unsigned long stlb_misses;
+  unsigned long page_walks;
+  unsigned long page_walk_references;
+  unsigned long page_walk_cache_hits;
+} __attribute__((packed));
+
+struct filtered_trace_record {
+  unsigned long pc;
+  unsigned long address;
+  unsigned int cycles; /* L1 stage cycles since the previous record */
+  unsigned char type;  /* L1 miss - L1 write to L2 - L1I miss - L1I prefetch - Page walk miss */
+} __attribute__((packed));
+
+struct latency_histogram {
+  unsigned long long counts[LATENCY_BUCKETS];
+  unsigned long long total;
+  unsigned long max;
+};
+
+struct region_entry {
+  unsigned long region; /* Region number plus one, zero when the slot is empty */
+  unsigned long long accesses;
+  unsigned long long misses;
+  unsigned long long prefetch_fills;
+  unsigned int interval_accesses;
+  unsigned int interval_misses;
+  unsigned int interval_prefetch_fills;
+};
+
+/* Open addressing hash map from region to its counters */
+struct region_profile {
+  struct region_entry *entries;
+  unsigned long size;
+  unsigned long used;
+  unsigned long region_size;
+  unsigned long interval;
+  FILE *heatmap;
+};
+
+struct fetch_successor_entry {
+  unsigned long line;
+  unsigned long target;
+  int valid;
+};
+
+struct tlb_entry {
+  unsigned long page;
+  unsigned long last_use;
+  int valid;
+};
+
+/* Set associative translation cache, also used for the page walk caches */
+struct tlb {
+  struct tlb_entry *entries;
+  unsigned int sets;
+  unsigned int ways;
+  unsigned long long hits;
+  unsigned long long misses;
+};
+
+struct write_buffer {
+  unsigned long *lines; /* Oldest first */
+  unsigned long *cycles;
+  unsigned int depth;
+  unsigned int count;
+  unsigned long drain_free;
+  unsigned long long coalesced;
+  unsigned long long full_stalls;
+  unsigned long long stall_cycles;
+};
+
+struct mshr_file {
+  unsigned long *ready; /* Cycle each outstanding miss completes */
+  unsigned int size;
+  unsigned long long allocations;
+  unsigned long long merges;
+  unsigned long long full_stalls;
+  unsigned long long stall_cycles;
+};
+
+struct dram_config {
+  unsigned int channels;
+  unsigned int ranks;
+  unsigned int banks;
+  unsigned int row_size;
+  unsigned int policy;
+  unsigned int trcd;
+  unsigned int tcas;
+  unsigned int trp;
+  unsigned int tburst;
+  unsigned int controller_latency;
+  unsigned int queue_size;
+};
+
+struct dram_request {
+  unsigned long address;
+  unsigned long arrival;
+  unsigned long row;
+  unsigned int bank;
+  int type; /* Demand - Prefetch - Write */
+};
+
+struct dram_bank {
+  unsigned long open_row;
+  unsigned long ready;
+  int row_open;
+};
+
+struct dram_channel {
+  struct dram_request *queue; /* Ordered by arrival */
+  struct dram_bank *banks;
+  unsigned int queued;
+  unsigned long next_issue;
+  unsigned long bus_free;
+};
+
+/* Options in effect for a run, what the results store keys it by. Options
+   a run does not use are left zero */
+struct run_config {
+  unsigned int prefetch_degree;
+  unsigned int prefetch_distance;
+  int feedback;
+  int replay;
+  int dram_model;
+  struct dram_config dram;
+  unsigned int l1_mshrs;
+  unsigned int l2_mshrs;
+  unsigned int rob_size;
+  unsigned int issue_width;
+  int write_back;
+  int write_allocate;
+  unsigned int write_buffer_depth;
+  int iprefetcher;
+  unsigned int page_shift;
+  int histograms;
+  unsigned long latency_interval;
+  unsigned long region_size;
+  unsigned int top_regions;
+  unsigned int l2_sample_shift;
+  int windowed;
+  unsigned long window_first;
+  unsigned long window_count;
+};
+
 static struct cache_entry l1_cache[L1_SIZE / (L1_BLOCK_SIZE * L1_WAYS)][L1_WAYS];
-static struct cache_entry l2_cache[L2_SIZE / (L2_BLOCK_SIZE * L2_WAYS)][L2_WAYS];
+static struct sector_entry (*l2_cache)[L2_WAYS] = NULL; /* Sampled sets only */
+static unsigned int l2_sample_shift = 0;
+static unsigned long l2_sample_mask = 0;
+static unsigned int *l2_sample_accesses = NULL, *l2_sample_misses = NULL;
+static unsigned long long l2_sector_misses = 0;
+static struct cache_entry l1i_cache[L1I_SETS][L1I_WAYS];
 static unsigned long long total_prefetches = 0;
 static unsigned long long useful_prefetches = 0;
+static unsigned int l2_prefetch_hit = 0;
+static struct dram_config dram = { DRAM_CHANNELS, DRAM_RANKS, DRAM_BANKS, DRAM_ROW_SIZE, DRAM_OPEN_ROW, DRAM_TRCD,
+                                   DRAM_TCAS, DRAM_TRP, DRAM_TBURST, DRAM_CONTROLLER_LATENCY, DRAM_QUEUE_SIZE };
+static struct dram_channel *dram_channels = NULL;
+static struct mshr_file l1_mshrs = { NULL, L1_MSHRS, 0, 0, 0, 0 };
+static struct mshr_file l2_mshrs = { NULL, L2_MSHRS, 0, 0, 0, 0 };
+static unsigned long long mshr_dropped_prefetches = 0;
+static struct write_buffer write_buffer = { NULL, NULL, WRITE_BUFFER_DEPTH, 0, 0, 0, 0, 0 };
+static unsigned long long l1_writebacks = 0, l2_writebacks = 0, dram_writes = 0;
+static unsigned long long useful_instruction_prefetches = 0, total_instruction_prefetches = 0;
+static struct tlb dtlb, stlb, page_walk_caches[PAGE_TABLE_LEVELS - 1];
+static unsigned int page_shift = 0; /* Zero when translation is not simulated */
+static unsigned long long page_walks = 0, page_walk_references = 0, page_walk_cycles = 0;
+static struct latency_histogram latency_histograms[LATENCY_CLASSES];
+static struct latency_histogram interval_histograms[LATENCY_CLASSES];
+static struct region_profile profile = { NULL, 0, 0, PAGE_SIZE, 0, NULL };
+static FILE *filtered_trace = NULL;
+static FILE *trace_file = NULL; /* Opened by get_opcode() unless already positioned */
+static unsigned long filtered_records = 0, filtered_cycles = 0;
+static unsigned long long dram_row_hits = 0, dram_row_misses = 0, dram_row_conflicts = 0;
+static unsigned long long dram_demand_reads = 0, dram_prefetch_reads = 0, dram_dropped_prefetches = 0;
+static unsigned long long dram_demand_latency = 0;
+static unsigned int prefetch_degree = PREFETCH_DEGREE;
+static unsigned int prefetch_distance = PREFETCH_DISTANCE;
+static unsigned long long late_prefetches = 0;
+static unsigned long long polluting_misses = 0;
+static unsigned long pollution_filter[FDP_POLLUTION_FILTER_BITS / (8 * sizeof(unsigned long))];
+
+/* Aggressiveness levels for feedback directed throttling, level 0 is off */
+static const unsigned int throttle_degrees[FDP_LEVELS]   = { 0, 1, 1, 2, 2, 4 };
+static const unsigned int throttle_distances[FDP_LEVELS] = { 0, 1, 2, 4, 8, 16 };
 
 int get_least_recently_used(struct cache_entry entries[], unsigned int nways) {
   int result = 0;
@@ -160,6 +570,11 @@ int not_most_recently_used(struct delta_history_table_entry *dbh) {
   return result;
 }
 
+/* Page (or profiled region) holding address */
+unsigned long get_page_number(unsigned long address, unsigned long page_size) {
+  return address / page_size;
+}
+
 int fetch_data_from_l1(unsigned long address, unsigned int *way, unsigned long cycle, unsigned long *penalty) {
   unsigned long tag, index, offset __attribute((unused));
   unsigned int i;
@@ -180,235 +595,1295 @@ int fetch_data_from_l1(unsigned long address, unsigned int *way, unsigned long c
   return FETCH_MISS;
 }
 
-int fetch_data_from_l2(unsigned long address, unsigned int *way, unsigned long cycle, unsigned long *penalty) {
-  unsigned long tag, index, offset __attribute((unused));;
+void init_l2() {
+  unsigned long sets = L2_SETS >> l2_sample_shift;
+
+  l2_sample_mask = (1UL << l2_sample_shift) - 1;
+  l2_cache = calloc(sets, sizeof *l2_cache);
+  l2_sample_accesses = calloc(sets, sizeof(unsigned int));
+  l2_sample_misses = calloc(sets, sizeof(unsigned int));
+
+  if(l2_cache == NULL || l2_sample_accesses == NULL || l2_sample_misses == NULL) {
+    fprintf(stderr, "Could not allocate L2.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* Sector of L2 holding address, or NULL, also for unsampled sets */
+struct sector_entry *get_l2_sector(unsigned long address) {
+  unsigned long tag, index;
   unsigned int i;
 
-  tag = address >> 19;
-  index = (address >> 6) & 0xFFF;
-  offset = address & 0x3F;
+  if(!L2_SAMPLED(address)) {
+    return NULL;
+  }
 
-  for(i = 0; i < L2_WAYS; ++i) {
-    if(l2_cache[index][i].valid == 1 && l2_cache[index][i].tag == tag) {
-      if(l2_cache[index][i].prefetched == 1) {
-        l2_cache[index][i].prefetched = 0;
-        ++useful_prefetches;
-      }
+  tag = address / (L2_SECTOR_SIZE * L2_SETS);
+  index = L2_SAMPLED_SET(address);
 
-      *way = i;
-      *penalty = (l2_cache[index][i].cycle > cycle) ? (l2_cache[index][i].cycle - cycle) : 0;
-      return FETCH_HIT;
+  for(i = 0; i < L2_WAYS; ++i) {
+    if(l2_cache[index][i].valid != 0 && l2_cache[index][i].tag == tag) {
+      return &l2_cache[index][i];
     }
   }
 
-  *penalty = 0;
-  return FETCH_MISS;
+  return NULL;
 }
 
-void write_l1_data(unsigned long address, int way, int dirty, unsigned long cycle) {
-  unsigned long tag, index, offset __attribute__((unused));
-
-  tag = address >> 14;
-  index = (address >> 6) & 0xFF;
-  offset = address & 0x3F;
+int get_least_recently_used_sector(struct sector_entry entries[]) {
+  int result = 0;
+  unsigned int i;
 
-  if(way < 0) {
-    way = get_least_recently_used(l1_cache[index], L1_WAYS);
+  for(i = 1; i < L2_WAYS; ++i) {
+    if(entries[i].cycle < entries[result].cycle) {
+      result = i;
+    }
   }
 
-  l1_cache[index][way].valid = 1;
-  l1_cache[index][way].dirty = dirty;
-  l1_cache[index][way].prefetched = 0;
-  l1_cache[index][way].tag = tag;
-  l1_cache[index][way].cycle = cycle + L1_LATENCY;
+  return result;
 }
 
-void write_l2_data(unsigned long address, int way, int dirty, int prefetched, unsigned long cycle) {
-  unsigned long tag, index, offset __attribute__((unused));
+/* Bit of a block in the pollution filter. The tag is folded into the set
+   index, so the blocks of one L2 set do not all share a bit */
+unsigned long pollution_filter_bit(unsigned long line) {
+  return (line ^ (line / FDP_POLLUTION_FILTER_BITS) ^ (line / FDP_POLLUTION_FILTER_BITS / FDP_POLLUTION_FILTER_BITS)) %
+         FDP_POLLUTION_FILTER_BITS;
+}
 
-  tag = address >> 19;
-  index = (address >> 6) & 0xFFF;
-  offset = address & 0x3F;
+int fetch_data_from_l2(unsigned long address, unsigned int *way, unsigned long cycle, unsigned long *penalty) {
+  struct sector_entry *sector;
+  unsigned int i, bit = L2_BLOCK_BIT(address);
 
-  if(way < 0) {
-    way = get_least_recently_used(l2_cache[index], L1_WAYS);
+  ++l2_sample_accesses[L2_SAMPLED_SET(address)];
+
+  if((sector = get_l2_sector(address)) != NULL && (sector->valid & bit) != 0) {
+    if(sector->prefetched & bit) {
+      sector->prefetched &= ~bit;
+      l2_prefetch_hit = 1;
+      ++useful_prefetches;
+
+      if(sector->ready[L2_BLOCK(address)] > cycle) {
+        ++late_prefetches;
+      }
+    }
+
+    *way = sector - l2_cache[L2_SAMPLED_SET(address)];
+    *penalty = (sector->ready[L2_BLOCK(address)] > cycle) ? (sector->ready[L2_BLOCK(address)] - cycle) : 0;
+    return FETCH_HIT;
   }
 
-  if(prefetched == 1) {
-    ++total_prefetches;
+  /* Tag hit on a sector missing the block */
+  l2_sector_misses += (sector != NULL);
+  ++l2_sample_misses[L2_SAMPLED_SET(address)];
+
+  /* Demand miss on a line that a prefetch evicted */
+  i = pollution_filter_bit(address / L2_BLOCK_SIZE);
+
+  if(pollution_filter[i / (8 * sizeof(unsigned long))] & (1UL << (i % (8 * sizeof(unsigned long))))) {
+    pollution_filter[i / (8 * sizeof(unsigned long))] &= ~(1UL << (i % (8 * sizeof(unsigned long))));
+    ++polluting_misses;
   }
 
-  l2_cache[index][way].valid = 1;
-  l2_cache[index][way].dirty = dirty;
-  l2_cache[index][way].prefetched = prefetched;
-  l2_cache[index][way].tag = tag;
-  l2_cache[index][way].cycle = cycle + L2_LATENCY;
+  *penalty = 0;
+  return FETCH_MISS;
 }
 
-void no_prefetcher(unsigned long pc, unsigned long address, unsigned long cycle, unsigned int missed_l2) {
-  /* Does nothing */
-}
+int l2_contains(unsigned long address) {
+  struct sector_entry *sector = get_l2_sector(address);
 
-void stride_based_prefetcher(unsigned long pc, unsigned long address, unsigned long cycle, unsigned int missed_l2) {
-  static struct reference_prediction_entry reference_prediction_table[STRIDE_PREFETCHER_ENTRIES];
-  static int initialized = 0;
-  int index, available;
-  unsigned int i;
+  return sector != NULL && (sector->valid & L2_BLOCK_BIT(address)) != 0;
+}
 
-  if(initialized == 0) {
-    for(i = 0; i < STRIDE_PREFETCHER_ENTRIES; ++i) {
-      reference_prediction_table[i].state = STATE_INIT;
-    }
+void init_mshrs(struct mshr_file *file) {
+  file->ready = calloc(file->size, sizeof(unsigned long));
 
-    initialized = 1;
+  if(file->ready == NULL) {
+    fprintf(stderr, "Could not allocate MSHRs.\n");
+    exit(EXIT_FAILURE);
   }
+}
 
-  index = -1;
-  available = -1;
+/* Returns a register free at cycle, or -1 when all misses are outstanding.
+   Without -n/-o the files are not allocated and never fill up */
+int mshr_find_free(struct mshr_file *file, unsigned long cycle) {
+  unsigned int i;
 
-  for(i = 0; i < STRIDE_PREFETCHER_ENTRIES; ++i) {
-    if(reference_prediction_table[i].state == STATE_INIT && available == -1) {
-      available = i;
-    }
+  if(file->ready == NULL) {
+    return 0;
+  }
 
-    if(reference_prediction_table[i].tag == pc) {
-      index = i;
-      break;
+  for(i = 0; i < file->size; ++i) {
+    if(file->ready[i] <= cycle) {
+      return i;
     }
   }
 
-  if(index == -1 && available != -1) {
-    reference_prediction_table[available].tag = pc;
-    reference_prediction_table[available].last_address = address;
-    reference_prediction_table[available].state = STATE_TRANSIENT;
-    reference_prediction_table[available].stride = 0;
+  return -1;
+}
+
+/* Allocates a register for a primary miss. When all of them are busy the
+   miss waits, and cycle is moved to when the first one completes */
+unsigned int mshr_allocate(struct mshr_file *file, unsigned long *cycle) {
+  unsigned int i, first = 0;
+
+  if(file->ready == NULL) {
+    return 0;
   }
 
-  if(index != -1) {
-    /* Correct */
-    if(reference_prediction_table[index].stride == address - reference_prediction_table[index].last_address) {
-      if(reference_prediction_table[index].state == STATE_NO_PRED) {
-        reference_prediction_table[index].state = STATE_TRANSIENT;
-      } else {
-        reference_prediction_table[index].state = STATE_STEADY;
-      }
-    /* Incorrect */
-    } else {
-      if(reference_prediction_table[index].state == STATE_INIT) {
-        reference_prediction_table[index].stride = address - reference_prediction_table[index].last_address;
-        reference_prediction_table[index].state = STATE_TRANSIENT;
-      } else if(reference_prediction_table[index].state == STATE_TRANSIENT ||
-                reference_prediction_table[index].state == STATE_NO_PRED) {
-        reference_prediction_table[index].stride = address - reference_prediction_table[index].last_address;
-        reference_prediction_table[index].state = STATE_NO_PRED;
-      } else if(reference_prediction_table[index].state == STATE_STEADY) {
-        reference_prediction_table[index].state = STATE_INIT;
-      }
+  ++file->allocations;
+
+  for(i = 0; i < file->size; ++i) {
+    if(file->ready[i] <= *cycle) {
+      return i;
     }
 
-    if(reference_prediction_table[index].state != STATE_NO_PRED) {
-      write_l2_data(address + reference_prediction_table[index].stride, -1, 0, 1, cycle);
+    if(file->ready[i] < file->ready[first]) {
+      first = i;
     }
+  }
 
-    reference_prediction_table[index].last_address = address;
+  ++file->full_stalls;
+  file->stall_cycles += file->ready[first] - *cycle;
+  *cycle = file->ready[first];
+  return first;
+}
+
+/* Marks the register busy until the miss completes at cycle */
+void mshr_fill(struct mshr_file *file, unsigned int mshr, unsigned long cycle) {
+  if(file->ready != NULL) {
+    file->ready[mshr] = cycle;
   }
 }
 
-void variable_length_delta_prefetcher(unsigned long pc, unsigned long address, unsigned long cycle, unsigned int missed_l2) {
-  static struct delta_history_table_entry delta_history_table[DELTA_HISTORY_LENGTH];
-  static struct offset_prediction_table_entry offset_prediction_table[PAGE_SIZE / L2_BLOCK_SIZE];
-  static struct delta_prediction_table_entry delta_prediction_table[DELTA_PREDICTION_TABLES][PREDICTION_TABLE_LENGTH];
-  static int initialized = 0;
-  unsigned int page_number, matches, last_predictor, last_index, i, j, k;
-  int opt_index, dht_index = -1, dpt_index = -1, dpt_table = -1, delta = 0;
+/* Updates when a prefetched line still in flight becomes available */
+void set_l2_ready(unsigned long address, unsigned long cycle) {
+  struct sector_entry *sector = get_l2_sector(address);
+  unsigned int bit = L2_BLOCK_BIT(address);
 
-  if(initialized == 0) {
-    for(i = 0; i < PAGE_SIZE / L2_BLOCK_SIZE; ++i) {
-      offset_prediction_table[i].first_access = 0;
-    }
+  if(sector != NULL && (sector->valid & sector->prefetched & bit) != 0) {
+    sector->cycle = cycle + L2_LATENCY;
+    sector->ready[L2_BLOCK(address)] = cycle + L2_LATENCY;
+  }
+}
 
-    for(i = 0; i < DELTA_HISTORY_LENGTH; ++i) {
-      delta_history_table[i].last_predictor = INVALID_PREDICTOR;
-      delta_history_table[i].last_index = 0;
-      delta_history_table[i].times_used = 0;
+/* Parses a comma separated list of key=value DRAM parameters */
+void parse_dram_config(char *spec) {
+  char *option, *value, *tmp_ptr = NULL;
+
+  for(option = strtok_r(spec, ",", &tmp_ptr); option != NULL; option = strtok_r(NULL, ",", &tmp_ptr)) {
+    if((value = strchr(option, '=')) == NULL) {
+      fprintf(stderr, "Invalid DRAM parameter: %s\n", option);
+      exit(EXIT_FAILURE);
     }
 
-    for(i = 0; i < DELTA_PREDICTION_TABLES; ++i) {
-      for(j = 0; j < PREDICTION_TABLE_LENGTH; ++j) {
-        delta_prediction_table[i][j].nmru = 1;
-      }
+    *value++ = '\0';
+
+    if(strcmp(option, "channels") == 0) {
+      dram.channels = atoi(value);
+    } else if(strcmp(option, "ranks") == 0) {
+      dram.ranks = atoi(value);
+    } else if(strcmp(option, "banks") == 0) {
+      dram.banks = atoi(value);
+    } else if(strcmp(option, "row") == 0) {
+      dram.row_size = atoi(value);
+    } else if(strcmp(option, "policy") == 0) {
+      dram.policy = (strcmp(value, "closed") == 0) ? DRAM_CLOSED_ROW : DRAM_OPEN_ROW;
+    } else if(strcmp(option, "tRCD") == 0) {
+      dram.trcd = atoi(value);
+    } else if(strcmp(option, "tCAS") == 0) {
+      dram.tcas = atoi(value);
+    } else if(strcmp(option, "tRP") == 0) {
+      dram.trp = atoi(value);
+    } else if(strcmp(option, "tBURST") == 0) {
+      dram.tburst = atoi(value);
+    } else if(strcmp(option, "controller") == 0) {
+      dram.controller_latency = atoi(value);
+    } else if(strcmp(option, "queue") == 0) {
+      dram.queue_size = atoi(value);
+    } else {
+      fprintf(stderr, "Invalid DRAM parameter: %s\n", option);
+      exit(EXIT_FAILURE);
     }
+  }
 
-    initialized = 1;
+  if(dram.channels == 0 || dram.ranks == 0 || dram.banks == 0 || dram.row_size < L2_BLOCK_SIZE || dram.queue_size == 0) {
+    fprintf(stderr, "Invalid DRAM configuration.\n");
+    exit(EXIT_FAILURE);
   }
+}
 
-  /* Delta History Table */
-  page_number = address / PAGE_SIZE;
+void init_dram() {
+  unsigned int i;
 
-  /* Fully associative search */
-  for(i = 0; i < DELTA_HISTORY_LENGTH; ++i) {
-    if(delta_history_table[i].page_number == page_number) {
-      dht_index = i;
+  dram_channels = calloc(dram.channels, sizeof(struct dram_channel));
+
+  for(i = 0; i < dram.channels && dram_channels != NULL; ++i) {
+    dram_channels[i].queue = calloc(dram.queue_size, sizeof(struct dram_request));
+    dram_channels[i].banks = calloc(dram.ranks * dram.banks, sizeof(struct dram_bank));
+
+    if(dram_channels[i].queue == NULL || dram_channels[i].banks == NULL) {
       break;
     }
   }
 
-  if(missed_l2 == 0) {
-    if(dht_index != -1) {
-      for(i = 0; i < 4; ++i) {
-        if(delta_history_table[dht_index].last_prefetched_offsets[i] == address) {
-          goto pae; /* Ugly but works */
-        }
-      }
-    }
-
-    return; /* Not a PAE, don't do anything */
+  if(dram_channels == NULL || i < dram.channels) {
+    fprintf(stderr, "Could not allocate DRAM model.\n");
+    exit(EXIT_FAILURE);
   }
+}
 
-pae:
+/* Performs the row buffer and data bus operations for a request issued at
+   cycle and returns when its data reaches the cache */
+unsigned long dram_service(struct dram_channel *channel, struct dram_request *request, unsigned long cycle) {
+  struct dram_bank *bank = &channel->banks[request->bank];
+  unsigned long start, latency, data;
 
-  if(dht_index == -1) {
-    dht_index = not_most_recently_used(delta_history_table);
-    delta_history_table[dht_index].page_number = page_number;
-    delta_history_table[dht_index].times_used = 0;
+  start = (bank->ready > cycle) ? bank->ready : cycle;
+
+  if(bank->row_open != 0 && bank->open_row == request->row) {
+    latency = dram.tcas;
+    ++dram_row_hits;
+  } else if(bank->row_open == 0) {
+    latency = dram.trcd + dram.tcas;
+    ++dram_row_misses;
   } else {
-    delta = (address % PAGE_SIZE) - delta_history_table[dht_index].last_address;
+    latency = dram.trp + dram.trcd + dram.tcas;
+    ++dram_row_conflicts;
   }
 
-  delta_history_table[dht_index].last_address = address % PAGE_SIZE;
+  data = (start + latency > channel->bus_free) ? (start + latency) : channel->bus_free;
+  channel->bus_free = data + dram.tburst;
+  channel->next_issue = start + dram.tburst;
 
-  for(i = 0; i < 4; ++i) {
-    delta_history_table[dht_index].last_deltas[i + 1] = delta_history_table[dht_index].last_deltas[i];
+  if(dram.policy == DRAM_OPEN_ROW) {
+    bank->row_open = 1;
+    bank->open_row = request->row;
+    bank->ready = start + latency;
+  } else {
+    bank->row_open = 0;
+    bank->ready = data + dram.tburst + dram.trp;
   }
 
-  delta_history_table[dht_index].last_deltas[0] = delta;
+  return data + dram.tburst + dram.controller_latency;
+}
 
-  /* Offset Prediction Table */
-  opt_index = (address % PAGE_SIZE) / L2_BLOCK_SIZE;
+/* FR-FCFS scheduler: issues queued requests while the controller becomes free
+   before until, preferring the oldest row hit to a ready bank over the oldest
+   request. Stops once the demand read for address completes and returns its
+   completion cycle (0 otherwise) */
+unsigned long dram_schedule(struct dram_channel *channel, unsigned long until, unsigned long address) {
+  struct dram_request request;
+  struct dram_bank *bank;
+  unsigned long cycle, completion;
+  unsigned int i, pick;
 
-  if(offset_prediction_table[opt_index].first_access == 0) {
-    offset_prediction_table[opt_index].delta_prediction = 0;
-    offset_prediction_table[opt_index].accuracy = 0;
-    offset_prediction_table[opt_index].first_access = 1;
-  } else {
-    if(offset_prediction_table[opt_index].accuracy == 1) {
-      write_l2_data(address + offset_prediction_table[opt_index].delta_prediction, -1, 0, 1, cycle);
+  while(channel->queued > 0) {
+    cycle = (channel->next_issue > channel->queue[0].arrival) ? channel->next_issue : channel->queue[0].arrival;
+
+    if(cycle > until) {
+      break;
     }
 
-    if(address - offset_prediction_table[opt_index].last_address == offset_prediction_table[opt_index].delta_prediction) {
-      offset_prediction_table[opt_index].accuracy = 1;
-    } else {
-      if(offset_prediction_table[opt_index].accuracy == 0) {
-        offset_prediction_table[opt_index].delta_prediction = address - offset_prediction_table[opt_index].last_address;
+    for(pick = 0, i = 0; i < channel->queued && channel->queue[i].arrival <= cycle; ++i) {
+      bank = &channel->banks[channel->queue[i].bank];
+
+      if(bank->row_open != 0 && bank->open_row == channel->queue[i].row && bank->ready <= cycle) {
+        pick = i;
+        break;
       }
+    }
 
-      offset_prediction_table[opt_index].accuracy = 0;
+    request = channel->queue[pick];
+    memmove(&channel->queue[pick], &channel->queue[pick + 1], (channel->queued - pick - 1) * sizeof(struct dram_request));
+    --channel->queued;
+
+    completion = dram_service(channel, &request, cycle);
+
+    if(request.type == DRAM_PREFETCH) {
+      set_l2_ready(request.address, completion);
+    } else if(request.type == DRAM_DEMAND && request.address == address) {
+      return completion;
     }
   }
 
-  offset_prediction_table[opt_index].last_address = address;
+  return 0;
+}
 
-  /* Delta Prediction Table */
+/* Lets every channel issue the requests it would have issued by cycle */
+void dram_tick(unsigned long cycle) {
+  unsigned int i;
+
+  for(i = 0; dram_channels != NULL && i < dram.channels; ++i) {
+    if(dram_channels[i].queued > 0) {
+      dram_schedule(&dram_channels[i], cycle, ~0UL);
+    }
+  }
+}
+
+/* Queues a request on its channel using a Row:Rank:Bank:Column:Channel
+   address mapping. When the queue is full, prefetches are dropped (NULL is
+   returned) and other requests wait for a slot, moving cycle forward */
+struct dram_request *dram_enqueue(unsigned long address, unsigned long *cycle, int type, struct dram_channel **channel) {
+  struct dram_request *request;
+  unsigned long line, slot;
+  unsigned int i;
+
+  line = address / L2_BLOCK_SIZE;
+  *channel = &dram_channels[line % dram.channels];
+  line /= dram.channels;
+  line /= dram.row_size / L2_BLOCK_SIZE;
+
+  dram_schedule(*channel, *cycle, ~0UL);
+
+  if((*channel)->queued == dram.queue_size && type == DRAM_PREFETCH) {
+    ++dram_dropped_prefetches;
+    return NULL;
+  }
+
+  while((*channel)->queued == dram.queue_size) {
+    slot = ((*channel)->next_issue > (*channel)->queue[0].arrival) ? (*channel)->next_issue : (*channel)->queue[0].arrival;
+    dram_schedule(*channel, slot, ~0UL);
+    *cycle = (slot > *cycle) ? slot : *cycle;
+  }
+
+  /* Out-of-order cores may issue requests older than queued ones */
+  for(i = (*channel)->queued; i > 0 && (*channel)->queue[i - 1].arrival > *cycle; --i);
+
+  memmove(&(*channel)->queue[i + 1], &(*channel)->queue[i], ((*channel)->queued - i) * sizeof(struct dram_request));
+  ++(*channel)->queued;
+
+  request = &(*channel)->queue[i];
+  request->address = address & ~((unsigned long) L2_BLOCK_SIZE - 1);
+  request->arrival = *cycle;
+  request->bank = line % (dram.ranks * dram.banks);
+  request->row = line / (dram.ranks * dram.banks);
+  request->type = type;
+  return request;
+}
+
+/* Reads a line from DRAM. Returns when the data is available, or 0 when a
+   prefetch is dropped because the channel queue is full. Without the banked
+   model every read costs DRAM_LATENCY */
+unsigned long dram_read(unsigned long address, unsigned long cycle, int prefetch) {
+  struct dram_channel *channel;
+  struct dram_request *request;
+  unsigned long arrival = cycle, completion;
+
+  if(dram_channels == NULL) {
+    return cycle + DRAM_LATENCY;
+  }
+
+  if((request = dram_enqueue(address, &cycle, (prefetch != 0) ? DRAM_PREFETCH : DRAM_DEMAND, &channel)) == NULL) {
+    return 0;
+  }
+
+  if(prefetch != 0) {
+    ++dram_prefetch_reads;
+
+    /* Estimate until the scheduler gets to it */
+    return cycle + dram.trp + dram.trcd + dram.tcas + (channel->queued * dram.tburst) + dram.controller_latency;
+  }
+
+  ++dram_demand_reads;
+  completion = dram_schedule(channel, ~0UL, request->address);
+  dram_demand_latency += completion - arrival;
+  return completion;
+}
+
+/* Writes a dirty line back to DRAM. Writes never stall the core, but they
+   take queue slots, banks and the data bus like reads do */
+void dram_write(unsigned long address, unsigned long cycle) {
+  struct dram_channel *channel;
+
+  ++dram_writes;
+
+  if(dram_channels != NULL) {
+    dram_enqueue(address, &cycle, DRAM_WRITE, &channel);
+  }
+}
+
+/* Returns the address of the dirty line evicted by the fill, or 0 */
+unsigned long write_l1_data(unsigned long address, int way, int dirty, unsigned long cycle) {
+  unsigned long tag, index, offset __attribute__((unused));
+  unsigned long victim = 0;
+
+  tag = address >> 14;
+  index = (address >> 6) & 0xFF;
+  offset = address & 0x3F;
+
+  SELF_PROFILE_ENTER(SELF_FILL);
+
+  if(way < 0) {
+    way = get_least_recently_used(l1_cache[index], L1_WAYS);
+
+    if(l1_cache[index][way].valid == 1 && l1_cache[index][way].dirty == 1) {
+      victim = ((l1_cache[index][way].tag << 8) | index) << 6;
+    }
+  }
+
+  l1_cache[index][way].valid = 1;
+  l1_cache[index][way].dirty = dirty;
+  l1_cache[index][way].prefetched = 0;
+  l1_cache[index][way].tag = tag;
+  l1_cache[index][way].cycle = cycle + L1_LATENCY;
+
+  SELF_PROFILE_LEAVE();
+  return victim;
+}
+
+/* Fills a block into its sector, replacing the least recently filled
+   sector of the set when the tag is absent. Blocks of a sector still
+   arriving share the arrival time of its latest fill */
+void write_l2_data(unsigned long address, int dirty, int prefetched, unsigned long cycle) {
+  struct sector_entry *sector;
+  unsigned long index, line;
+  unsigned int i, bit = L2_BLOCK_BIT(address);
+
+  if(!L2_SAMPLED(address)) {
+    return;
+  }
+
+  SELF_PROFILE_ENTER(SELF_FILL);
+  index = (address / L2_SECTOR_SIZE) % L2_SETS;
+
+  if(prefetched == 1) {
+    ++total_prefetches;
+  }
+
+  if((sector = get_l2_sector(address)) == NULL) {
+    sector = &l2_cache[L2_SAMPLED_SET(address)][get_least_recently_used_sector(l2_cache[L2_SAMPLED_SET(address)])];
+    line = (sector->tag * L2_SETS + index) * L2_SECTOR_BLOCKS;
+
+    for(i = 0; i < L2_SECTOR_BLOCKS; ++i) {
+      if(sector->dirty & (1U << i)) {
+        dram_write((line + i) * L2_BLOCK_SIZE, cycle);
+        ++l2_writebacks;
+      }
+
+      if(prefetched == 1 && (sector->valid & ~sector->prefetched & (1U << i))) {
+        unsigned long victim = pollution_filter_bit(line + i);
+        pollution_filter[victim / (8 * sizeof(unsigned long))] |= 1UL << (victim % (8 * sizeof(unsigned long)));
+      }
+    }
+
+    sector->tag = address / (L2_SECTOR_SIZE * L2_SETS);
+    sector->valid = 0;
+    sector->dirty = 0;
+    sector->prefetched = 0;
+  }
+
+  sector->valid |= bit;
+  sector->dirty = dirty ? (sector->dirty | bit) : (sector->dirty & ~bit);
+  sector->prefetched = prefetched ? (sector->prefetched | bit) : (sector->prefetched & ~bit);
+  sector->ready[L2_BLOCK(address)] = cycle + L2_LATENCY;
+  sector->cycle = cycle + L2_LATENCY;
+
+  SELF_PROFILE_LEAVE();
+}
+
+void init_tlb(struct tlb *tlb, unsigned int entries, unsigned int ways) {
+  tlb->sets = entries / ways;
+  tlb->ways = ways;
+
+  if((tlb->entries = calloc(entries, sizeof(struct tlb_entry))) == NULL) {
+    fprintf(stderr, "Could not allocate TLB.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void init_translation() {
+  unsigned int i;
+
+  init_tlb(&dtlb, (page_shift == HUGE_PAGE_SHIFT) ? DTLB_HUGE_ENTRIES : DTLB_ENTRIES, DTLB_WAYS);
+  init_tlb(&stlb, STLB_ENTRIES, STLB_WAYS);
+
+  for(i = 0; i < PAGE_TABLE_LEVELS - 1; ++i) {
+    init_tlb(&page_walk_caches[i], PWC_ENTRIES, PWC_ENTRIES);
+  }
+}
+
+/* Looks page up with LRU replacement, filling it on a miss */
+int tlb_access(struct tlb *tlb, unsigned long page) {
+  static unsigned long clock = 0;
+  struct tlb_entry *set = &tlb->entries[(page % tlb->sets) * tlb->ways];
+  unsigned int i, lru = 0;
+
+  ++clock;
+
+  for(i = 0; i < tlb->ways; ++i) {
+    if(set[i].valid == 1 && set[i].page == page) {
+      set[i].last_use = clock;
+      ++tlb->hits;
+      return FETCH_HIT;
+    }
+
+    if(set[lru].valid == 1 && (set[i].valid == 0 || set[i].last_use < set[lru].last_use)) {
+      lru = i;
+    }
+  }
+
+  set[lru].page = page;
+  set[lru].last_use = clock;
+  set[lru].valid = 1;
+  ++tlb->misses;
+  return FETCH_MISS;
+}
+
+unsigned long page_walk_cache_hits() {
+  unsigned long hits = 0;
+  unsigned int i;
+
+  for(i = 0; i < PAGE_TABLE_LEVELS - 1; ++i) {
+    hits += page_walk_caches[i].hits;
+  }
+
+  return hits;
+}
+
+/* Physical address of the entry translating address at a page table level,
+   the root being level 0. Tables are 4KB frames placed by hashing the
+   address bits above the ones the level indexes */
+unsigned long page_table_entry(unsigned long address, unsigned int level) {
+  unsigned int shift = SMALL_PAGE_SHIFT + PAGE_TABLE_INDEX_BITS * (PAGE_TABLE_LEVELS - 1 - level);
+  unsigned long table;
+
+  table = (((address >> shift >> PAGE_TABLE_INDEX_BITS) << 2) | level) * 0x9E3779B97F4A7C15UL;
+  return PAGE_TABLE_BASE + ((table >> 32) % PAGE_TABLE_FRAMES) * 4096 +
+         ((address >> shift) & ((1UL << PAGE_TABLE_INDEX_BITS) - 1)) * 8;
+}
+
+/* Translates a data address through the DTLB and the STLB. When both miss,
+   the page walk caches skip the upper levels they hold and the page table
+   entries left to read are stored in walk, root first. Returns how many
+   entries the walk reads */
+unsigned int translate_address(unsigned long address, unsigned long *latency, unsigned long walk[]) {
+  unsigned long page = address >> page_shift;
+  unsigned int leaf, level, references = 0;
+
+  *latency = 0;
+
+  if(tlb_access(&dtlb, page) == FETCH_HIT) {
+    return 0;
+  }
+
+  *latency = STLB_LATENCY;
+
+  if(tlb_access(&stlb, page) == FETCH_HIT) {
+    return 0;
+  }
+
+  /* Huge pages are mapped one level above the last one */
+  leaf = PAGE_TABLE_LEVELS - 1 - (page_shift == HUGE_PAGE_SHIFT);
+
+  for(level = leaf; level > 0; --level) {
+    if(tlb_access(&page_walk_caches[level - 1], address >> (SMALL_PAGE_SHIFT + PAGE_TABLE_INDEX_BITS * (PAGE_TABLE_LEVELS - level))) == FETCH_HIT) {
+      break;
+    }
+  }
+
+  for(; level <= leaf; ++level) {
+    walk[references++] = page_table_entry(address, level);
+  }
+
+  ++page_walks;
+  page_walk_references += references;
+  return references;
+}
+
+void write_filtered_header(unsigned long l1_hit, unsigned long l1_miss, unsigned long l1i_hit, unsigned long l1i_miss, unsigned long tail_cycles) {
+  struct filtered_trace_header header;
+
+  memcpy(header.magic, FILTERED_TRACE_MAGIC, sizeof header.magic);
+  header.version = FILTERED_TRACE_VERSION;
+  header.l1_size = L1_SIZE;
+  header.l1_ways = L1_WAYS;
+  header.l1_block_size = L1_BLOCK_SIZE;
+  header.records = filtered_records;
+  header.l1_hit = l1_hit;
+  header.l1_miss = l1_miss;
+  header.l1_writebacks = l1_writebacks;
+  header.l1i_hit = l1i_hit;
+  header.l1i_miss = l1i_miss;
+  header.l1i_useful_prefetches = useful_instruction_prefetches;
+  header.l1i_total_prefetches = total_instruction_prefetches;
+  header.tail_cycles = tail_cycles;
+  header.page_shift = page_shift;
+  header.dtlb_hits = dtlb.hits;
+  header.dtlb_misses = dtlb.misses;
+  header.stlb_hits = stlb.hits;
+  header.stlb_misses = stlb.misses;
+  header.page_walks = page_walks;
+  header.page_walk_references = page_walk_references;
+  header.page_walk_cache_hits = page_walk_cache_hits();
+
+  rewind(filtered_trace);
+
+  if(fwrite(&header, sizeof header, 1, filtered_trace) != 1) {
+    fprintf(stderr, "Could not write filtered trace.\n");
+    exit(1);
+  }
+}
+
+/* Appends a record to the filtered trace. Cycles are stored relative to the
+   end of the previous L1 miss, which completes L1_LATENCY cycles after it
+   was looked up, so replay can add the L2 stage in between. Writes and
+   instruction prefetches issued while a miss completes are replayed right
+   after it */
+void write_filtered_record(unsigned long pc, unsigned long address, unsigned long cycle, unsigned char type) {
+  static unsigned long last_cycle = 0;
+  struct filtered_trace_record record;
+
+  record.pc = pc;
+  record.address = address;
+  record.cycles = (cycle > last_cycle) ? (cycle - last_cycle) : 0;
+  record.type = type;
+
+  if(type == FILTERED_L1_MISS || type == FILTERED_L1_WALK_MISS) {
+    last_cycle = cycle + L1_LATENCY;
+  } else if(cycle > last_cycle) {
+    last_cycle = cycle;
+  }
+
+  if(fwrite(&record, sizeof record, 1, filtered_trace) != 1) {
+    fprintf(stderr, "Could not write filtered trace.\n");
+    exit(1);
+  }
+
+  filtered_cycles = last_cycle;
+  ++filtered_records;
+}
+
+int get_filtered_record(const char *filename, struct filtered_trace_header *header, struct filtered_trace_record *record) {
+  static FILE *file = NULL;
+
+  /* Charged to parsing until the loop body switches away */
+  SELF_PROFILE_SWITCH(SELF_PARSE);
+
+  if(file == NULL) {
+    file = fopen(filename, "rb");
+    if(file == NULL) {
+      printf("Could not open file.\n");
+      exit(1);
+    }
+
+    if(fread(header, sizeof *header, 1, file) != 1 || memcmp(header->magic, FILTERED_TRACE_MAGIC, sizeof header->magic) != 0) {
+      printf("Error reading trace (Not an L1-filtered trace)\n");
+      exit(2);
+    }
+
+    if(header->version != FILTERED_TRACE_VERSION) {
+      printf("Error reading trace (L1-filtered trace version %u, expected %u)\n", header->version, FILTERED_TRACE_VERSION);
+      exit(2);
+    }
+  }
+
+  return fread(record, sizeof *record, 1, file) == 1;
+}
+
+int fetch_instruction_from_l1i(unsigned long address, unsigned long cycle, unsigned long *penalty) {
+  unsigned long tag, index;
+  unsigned int i;
+
+  tag = address / (L1I_BLOCK_SIZE * L1I_SETS);
+  index = (address / L1I_BLOCK_SIZE) % L1I_SETS;
+
+  for(i = 0; i < L1I_WAYS; ++i) {
+    if(l1i_cache[index][i].valid == 1 && l1i_cache[index][i].tag == tag) {
+      if(l1i_cache[index][i].prefetched == 1) {
+        l1i_cache[index][i].prefetched = 0;
+        ++useful_instruction_prefetches;
+      }
+
+      *penalty = (l1i_cache[index][i].cycle > cycle) ? (l1i_cache[index][i].cycle - cycle) : 0;
+      return FETCH_HIT;
+    }
+  }
+
+  *penalty = 0;
+  return FETCH_MISS;
+}
+
+int l1i_contains(unsigned long address) {
+  unsigned long tag, index;
+  unsigned int i;
+
+  tag = address / (L1I_BLOCK_SIZE * L1I_SETS);
+  index = (address / L1I_BLOCK_SIZE) % L1I_SETS;
+
+  for(i = 0; i < L1I_WAYS; ++i) {
+    if(l1i_cache[index][i].valid == 1 && l1i_cache[index][i].tag == tag) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+void write_l1i_data(unsigned long address, int prefetched, unsigned long cycle) {
+  unsigned long index;
+  int way;
+
+  SELF_PROFILE_ENTER(SELF_FILL);
+
+  index = (address / L1I_BLOCK_SIZE) % L1I_SETS;
+  way = get_least_recently_used(l1i_cache[index], L1I_WAYS);
+
+  l1i_cache[index][way].valid = 1;
+  l1i_cache[index][way].dirty = 0;
+  l1i_cache[index][way].prefetched = prefetched;
+  l1i_cache[index][way].tag = address / (L1I_BLOCK_SIZE * L1I_SETS);
+  l1i_cache[index][way].cycle = cycle;
+
+  SELF_PROFILE_LEAVE();
+}
+
+void mark_l1_dirty(unsigned long address, unsigned int way) {
+  l1_cache[(address >> 6) & 0xFF][way].dirty = 1;
+}
+
+/* Writes a line coming from L1 into L2, allocating it when absent */
+void writeback_l2_data(unsigned long address, unsigned long cycle) {
+  struct sector_entry *sector = get_l2_sector(address);
+  unsigned int bit = L2_BLOCK_BIT(address);
+
+  if(sector != NULL && (sector->valid & bit) != 0) {
+    sector->dirty |= bit;
+    return;
+  }
+
+  write_l2_data(address, 1, 0, cycle);
+}
+
+void init_write_buffer() {
+  write_buffer.lines = calloc(write_buffer.depth, sizeof(unsigned long));
+  write_buffer.cycles = calloc(write_buffer.depth, sizeof(unsigned long));
+
+  if(write_buffer.lines == NULL || write_buffer.cycles == NULL) {
+    fprintf(stderr, "Could not allocate write buffer.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* Drains, oldest first, every entry L2 could have accepted by until. Each
+   drain holds the L2 write port for L2_LATENCY cycles */
+void write_buffer_drain(unsigned long until) {
+  unsigned long start;
+
+  while(write_buffer.count > 0) {
+    start = (write_buffer.drain_free > write_buffer.cycles[0]) ? write_buffer.drain_free : write_buffer.cycles[0];
+
+    if(until != ~0UL && start + L2_LATENCY > until) {
+      break;
+    }
+
+    writeback_l2_data(write_buffer.lines[0], start);
+    write_buffer.drain_free = start + L2_LATENCY;
+
+    --write_buffer.count;
+    memmove(&write_buffer.lines[0], &write_buffer.lines[1], write_buffer.count * sizeof(unsigned long));
+    memmove(&write_buffer.cycles[0], &write_buffer.cycles[1], write_buffer.count * sizeof(unsigned long));
+  }
+}
+
+/* Queues a write to L2, coalescing writes to a line already waiting. When
+   the buffer is full the write waits for the oldest entry to drain, and the
+   cycle the write was accepted is returned */
+unsigned long write_buffer_insert(unsigned long address, unsigned long cycle) {
+  unsigned long line = address & ~((unsigned long) L1_BLOCK_SIZE - 1), start;
+  unsigned int i;
+
+  write_buffer_drain(cycle);
+
+  for(i = 0; i < write_buffer.count; ++i) {
+    if(write_buffer.lines[i] == line) {
+      ++write_buffer.coalesced;
+      return cycle;
+    }
+  }
+
+  if(write_buffer.count == write_buffer.depth) {
+    start = (write_buffer.drain_free > write_buffer.cycles[0]) ? write_buffer.drain_free : write_buffer.cycles[0];
+    write_buffer_drain(start + L2_LATENCY);
+
+    ++write_buffer.full_stalls;
+    write_buffer.stall_cycles += start + L2_LATENCY - cycle;
+    cycle = start + L2_LATENCY;
+  }
+
+  write_buffer.lines[write_buffer.count] = line;
+  write_buffer.cycles[write_buffer.count] = cycle;
+  ++write_buffer.count;
+  return cycle;
+}
+
+void init_profile() {
+  profile.size = PROFILE_INITIAL_ENTRIES;
+
+  if((profile.entries = calloc(profile.size, sizeof(struct region_entry))) == NULL) {
+    fprintf(stderr, "Could not allocate region profile.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+struct region_entry *profile_find(unsigned long region) {
+  struct region_entry *entries;
+  unsigned long i, j, size;
+
+  i = ((region + 1) * 0x9E3779B97F4A7C15UL) & (profile.size - 1);
+
+  while(profile.entries[i].region != 0 && profile.entries[i].region != region + 1) {
+    i = (i + 1) & (profile.size - 1);
+  }
+
+  if(profile.entries[i].region != 0) {
+    return &profile.entries[i];
+  }
+
+  /* Keep the map at most half full, doubling it before inserting */
+  if(2 * (profile.used + 1) > profile.size) {
+    entries = profile.entries;
+    size = profile.size;
+
+    profile.size *= 2;
+    profile.used = 0;
+
+    if((profile.entries = calloc(profile.size, sizeof(struct region_entry))) == NULL) {
+      fprintf(stderr, "Could not allocate region profile.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    for(j = 0; j < size; ++j) {
+      if(entries[j].region != 0) {
+        *profile_find(entries[j].region - 1) = entries[j];
+      }
+    }
+
+    free(entries);
+    return profile_find(region);
+  }
+
+  profile.entries[i].region = region + 1;
+  ++profile.used;
+  return &profile.entries[i];
+}
+
+/* Writes a heatmap row per region touched in the current interval */
+void profile_flush_interval() {
+  struct region_entry *entry;
+  unsigned long i;
+
+  for(i = 0; i < profile.size; ++i) {
+    entry = &profile.entries[i];
+
+    if(entry->interval_accesses + entry->interval_prefetch_fills == 0) {
+      continue;
+    }
+
+    if(profile.heatmap != NULL) {
+      fprintf(profile.heatmap, "%lu %lu %u %u %u\n", profile.interval * PROFILE_INTERVAL, (entry->region - 1) * profile.region_size,
+              entry->interval_accesses, entry->interval_misses, entry->interval_prefetch_fills);
+    }
+
+    entry->interval_accesses = 0;
+    entry->interval_misses = 0;
+    entry->interval_prefetch_fills = 0;
+  }
+}
+
+void profile_event(unsigned long address, unsigned long cycle, unsigned int accesses, unsigned int misses, unsigned int prefetch_fills) {
+  struct region_entry *entry;
+
+  if(cycle / PROFILE_INTERVAL > profile.interval) {
+    profile_flush_interval();
+    profile.interval = cycle / PROFILE_INTERVAL;
+  }
+
+  entry = profile_find(get_page_number(address, profile.region_size));
+  entry->accesses += accesses;
+  entry->misses += misses;
+  entry->prefetch_fills += prefetch_fills;
+  entry->interval_accesses += accesses;
+  entry->interval_misses += misses;
+  entry->interval_prefetch_fills += prefetch_fills;
+}
+
+/* Hottest regions first: most L2 misses, then most accesses */
+int compare_regions(const void *a, const void *b) {
+  const struct region_entry *x = a, *y = b;
+
+  if(x->misses != y->misses) {
+    return (x->misses < y->misses) ? 1 : -1;
+  }
+
+  return (x->accesses < y->accesses) ? 1 : ((x->accesses > y->accesses) ? -1 : 0);
+}
+
+void print_profile(unsigned int top) {
+  unsigned long i, n = 0;
+
+  profile_flush_interval();
+
+  for(i = 0; i < profile.size; ++i) {
+    if(profile.entries[i].region != 0) {
+      profile.entries[n++] = profile.entries[i];
+    }
+  }
+
+  qsort(profile.entries, n, sizeof(struct region_entry), compare_regions);
+
+  fprintf(stdout, "Profiled Regions: %lu (%lu bytes each)\n", n, profile.region_size);
+
+  for(i = 0; i < n && i < top; ++i) {
+    fprintf(stdout, "Region 0x%lx Accesses/L2 Misses/Prefetch Fills: %llu/%llu/%llu\n", (profile.entries[i].region - 1) * profile.region_size,
+            profile.entries[i].accesses, profile.entries[i].misses, profile.entries[i].prefetch_fills);
+  }
+}
+
+/* Prefetches a line into L2 unless it is already there, the line becomes
+   available once it arrives from DRAM */
+void prefetch_l2_data(unsigned long address, unsigned long cycle) {
+  unsigned long ready;
+  int mshr;
+
+  if(!L2_SAMPLED(address) || l2_contains(address) != 0) {
+    return;
+  }
+
+  /* Prefetches never wait for a miss register */
+  if((mshr = mshr_find_free(&l2_mshrs, cycle)) < 0) {
+    ++mshr_dropped_prefetches;
+    return;
+  }
+
+  if((ready = dram_read(address, cycle, 1)) != 0) {
+    mshr_fill(&l2_mshrs, mshr, ready);
+    write_l2_data(address, 0, 1, ready);
+
+    if(profile.entries != NULL) {
+      profile_event(address, ready, 0, 0, 1);
+    }
+  }
+}
+
+/* Issues prefetch_degree prefetches along step, starting prefetch_distance
+   steps ahead of address */
+void prefetch_l2_steps(unsigned long address, long step, unsigned long cycle) {
+  unsigned int i;
+
+  if(step == 0) {
+    return;
+  }
+
+  for(i = 0; i < prefetch_degree; ++i) {
+    prefetch_l2_data(address + step * (long) (prefetch_distance + i), cycle);
+  }
+}
+
+/* Feedback directed prefetching (Srinath et al., HPCA 2007): every
+   FDP_INTERVAL demand misses, samples accuracy, lateness and pollution and
+   moves the prefetcher one aggressiveness level up or down */
+void throttle_prefetcher(unsigned long l2_misses) {
+  static unsigned long long last_useful = 0, last_total = 0, last_late = 0, last_polluting = 0;
+  static unsigned long last_misses = 0;
+  static unsigned int level = FDP_INITIAL_LEVEL;
+  static unsigned int backoff = 1, idle = 0;
+  unsigned long long useful, total, late, polluting;
+  unsigned int accuracy, lateness, pollution;
+  int change = 0;
+
+  if(l2_misses - last_misses < FDP_INTERVAL) {
+    return;
+  }
+
+  useful = useful_prefetches - last_useful;
+  total = total_prefetches - last_total;
+  late = late_prefetches - last_late;
+  polluting = polluting_misses - last_polluting;
+
+  accuracy = (total > 0) ? (100 * useful / total) : 0;
+  lateness = (useful > 0) ? (100 * late / useful) : 0;
+  pollution = 100 * polluting / (l2_misses - last_misses);
+
+  if(level == 0) {
+    /* Off, probe again from the lowest active level once backoff intervals
+       have passed. Every failed probe doubles the wait */
+    if(++idle >= backoff) {
+      change = 1;
+      idle = 0;
+    }
+  } else if(total == 0) {
+    change = 0;
+  } else if(accuracy >= FDP_ACCURACY_HIGH) {
+    change = (lateness >= FDP_LATENESS_THRESHOLD) ? 1 : ((pollution >= FDP_POLLUTION_THRESHOLD) ? -1 : 0);
+  } else if(accuracy >= FDP_ACCURACY_LOW) {
+    change = (pollution >= FDP_POLLUTION_THRESHOLD) ? -1 : ((lateness >= FDP_LATENESS_THRESHOLD) ? 1 : 0);
+  } else {
+    change = (lateness >= FDP_LATENESS_THRESHOLD && pollution < FDP_POLLUTION_THRESHOLD) ? 0 : -1;
+  }
+
+  if(level > 0 && total > 0 && accuracy >= FDP_ACCURACY_LOW) {
+    backoff = 1;
+  } else if(level == 1 && change < 0 && backoff < FDP_MAX_BACKOFF) {
+    backoff *= 2;
+  }
+
+  if((change > 0 && level < FDP_LEVELS - 1) || (change < 0 && level > 0)) {
+    level += change;
+  }
+
+  prefetch_degree = throttle_degrees[level];
+  prefetch_distance = throttle_distances[level];
+
+  last_useful = useful_prefetches;
+  last_total = total_prefetches;
+  last_late = late_prefetches;
+  last_polluting = polluting_misses;
+  last_misses = l2_misses;
+}
+
+/* Brings a line for the instruction prefetcher from the unified L2, or from
+   DRAM through L2, and returns when it reaches L1I. From DRAM it is a
+   prefetch like the L2 ones, 0 is returned when it is dropped */
+unsigned long fetch_instruction_line(unsigned long address, unsigned long cycle) {
+  unsigned long ready;
+  int mshr;
+
+  if(!L2_SAMPLED(address) || l2_contains(address) != 0) {
+    return cycle + L2_LATENCY;
+  }
+
+  if((mshr = mshr_find_free(&l2_mshrs, cycle)) < 0) {
+    ++mshr_dropped_prefetches;
+    return 0;
+  }
+
+  if((ready = dram_read(address, cycle, 1)) == 0) {
+    return 0;
+  }
+
+  mshr_fill(&l2_mshrs, mshr, ready);
+  write_l2_data(address, 0, 0, ready);
+  return ready + L2_LATENCY;
+}
+
+/* Prefetches a line into L1I unless it is already there. While writing an
+   L1-filtered trace the L2 side is left to the replay */
+void prefetch_l1i_data(unsigned long address, unsigned long cycle) {
+  unsigned long ready;
+
+  if(l1i_contains(address) != 0) {
+    return;
+  }
+
+  if(filtered_trace != NULL) {
+    write_filtered_record(address, address, cycle, FILTERED_L1I_PREFETCH);
+    ready = cycle + L2_LATENCY;
+  } else if((ready = fetch_instruction_line(address, cycle)) == 0) {
+    return;
+  }
+
+  ++total_instruction_prefetches;
+  write_l1i_data(address, 1, ready);
+}
+
+/* Instruction prefetchers, called whenever fetch moves to a new line. The
+   fetch-directed one learns the line that follows each discontinuity of the
+   PC stream and runs FDIP_LOOKAHEAD lines ahead along that predicted path */
+void instruction_prefetcher(int type, unsigned long line, unsigned long previous_line, unsigned long cycle) {
+  static struct fetch_successor_entry successors[FDIP_SUCCESSOR_ENTRIES];
+  struct fetch_successor_entry *entry;
+  unsigned int i;
+
+  if(type == IPREFETCH_NEXT_LINE) {
+    for(i = 1; i <= NEXT_LINE_DEGREE; ++i) {
+      prefetch_l1i_data((line + i) * L1I_BLOCK_SIZE, cycle);
+    }
+  } else if(type == IPREFETCH_FETCH_DIRECTED) {
+    if(previous_line != ~0UL) {
+      entry = &successors[previous_line % FDIP_SUCCESSOR_ENTRIES];
+
+      if(line != previous_line + 1) {
+        entry->line = previous_line;
+        entry->target = line;
+        entry->valid = 1;
+      } else if(entry->valid != 0 && entry->line == previous_line) {
+        entry->valid = 0;
+      }
+    }
+
+    for(i = 0; i < FDIP_LOOKAHEAD; ++i) {
+      entry = &successors[line % FDIP_SUCCESSOR_ENTRIES];
+      line = (entry->valid != 0 && entry->line == line) ? entry->target : (line + 1);
+      prefetch_l1i_data(line * L1I_BLOCK_SIZE, cycle);
+    }
+  }
+}
+
+void no_prefetcher(unsigned long pc, unsigned long address, unsigned long cycle, unsigned int missed_l2) {
+  /* Does nothing */
+}
+
+void stride_based_prefetcher(unsigned long pc, unsigned long address, unsigned long cycle, unsigned int missed_l2) {
+  static struct reference_prediction_entry reference_prediction_table[STRIDE_PREFETCHER_ENTRIES];
+  static int initialized = 0;
+  int index, available;
+  unsigned int i;
+
+  if(initialized == 0) {
+    for(i = 0; i < STRIDE_PREFETCHER_ENTRIES; ++i) {
+      reference_prediction_table[i].state = STATE_INIT;
+    }
+
+    initialized = 1;
+  }
+
+  index = -1;
+  available = -1;
+
+  for(i = 0; i < STRIDE_PREFETCHER_ENTRIES; ++i) {
+    if(reference_prediction_table[i].state == STATE_INIT && available == -1) {
+      available = i;
+    }
+
+    if(reference_prediction_table[i].tag == pc) {
+      index = i;
+      break;
+    }
+  }
+
+  if(index == -1 && available != -1) {
+    reference_prediction_table[available].tag = pc;
+    reference_prediction_table[available].last_address = address;
+    reference_prediction_table[available].state = STATE_TRANSIENT;
+    reference_prediction_table[available].stride = 0;
+  }
+
+  if(index != -1) {
+    /* Correct */
+    if(reference_prediction_table[index].stride == address - reference_prediction_table[index].last_address) {
+      if(reference_prediction_table[index].state == STATE_NO_PRED) {
+        reference_prediction_table[index].state = STATE_TRANSIENT;
+      } else {
+        reference_prediction_table[index].state = STATE_STEADY;
+      }
+    /* Incorrect */
+    } else {
+      if(reference_prediction_table[index].state == STATE_INIT) {
+        reference_prediction_table[index].stride = address - reference_prediction_table[index].last_address;
+        reference_prediction_table[index].state = STATE_TRANSIENT;
+      } else if(reference_prediction_table[index].state == STATE_TRANSIENT ||
+                reference_prediction_table[index].state == STATE_NO_PRED) {
+        reference_prediction_table[index].stride = address - reference_prediction_table[index].last_address;
+        reference_prediction_table[index].state = STATE_NO_PRED;
+      } else if(reference_prediction_table[index].state == STATE_STEADY) {
+        reference_prediction_table[index].state = STATE_INIT;
+      }
+    }
+
+    if(reference_prediction_table[index].state != STATE_NO_PRED) {
+      prefetch_l2_steps(address, (int) reference_prediction_table[index].stride, cycle);
+    }
+
+    reference_prediction_table[index].last_address = address;
+  }
+}
+
+void variable_length_delta_prefetcher(unsigned long pc, unsigned long address, unsigned long cycle, unsigned int missed_l2) {
+  static struct delta_history_table_entry delta_history_table[DELTA_HISTORY_LENGTH];
+  static struct offset_prediction_table_entry offset_prediction_table[PAGE_SIZE / L2_BLOCK_SIZE];
+  static struct delta_prediction_table_entry delta_prediction_table[DELTA_PREDICTION_TABLES][PREDICTION_TABLE_LENGTH];
+  static int initialized = 0;
+  unsigned long page_number;
+  unsigned int matches, last_predictor, last_index, i, j, k;
+  int opt_index, dht_index = -1, dpt_index = -1, dpt_table = -1, delta = 0;
+
+  if(initialized == 0) {
+    for(i = 0; i < PAGE_SIZE / L2_BLOCK_SIZE; ++i) {
+      offset_prediction_table[i].first_access = 0;
+    }
+
+    for(i = 0; i < DELTA_HISTORY_LENGTH; ++i) {
+      delta_history_table[i].last_predictor = INVALID_PREDICTOR;
+      delta_history_table[i].last_index = 0;
+      delta_history_table[i].times_used = 0;
+    }
+
+    for(i = 0; i < DELTA_PREDICTION_TABLES; ++i) {
+      for(j = 0; j < PREDICTION_TABLE_LENGTH; ++j) {
+        delta_prediction_table[i][j].nmru = 1;
+      }
+    }
+
+    initialized = 1;
+  }
+
+  /* Delta History Table */
+  page_number = get_page_number(address, PAGE_SIZE);
+
+  /* Fully associative search */
+  for(i = 0; i < DELTA_HISTORY_LENGTH; ++i) {
+    if(delta_history_table[i].page_number == page_number) {
+      dht_index = i;
+      break;
+    }
+  }
+
+  if(missed_l2 == 0) {
+    if(dht_index != -1) {
+      for(i = 0; i < 4; ++i) {
+        if(delta_history_table[dht_index].last_prefetched_offsets[i] == address) {
+          goto pae; /* Ugly but works */
+        }
+      }
+    }
+
+    return; /* Not a PAE, don't do anything */
+  }
+
+pae:
+
+  if(dht_index == -1) {
+    dht_index = not_most_recently_used(delta_history_table);
+    delta_history_table[dht_index].page_number = page_number;
+    delta_history_table[dht_index].times_used = 0;
+  } else {
+    delta = (address % PAGE_SIZE) - delta_history_table[dht_index].last_address;
+  }
+
+  delta_history_table[dht_index].last_address = address % PAGE_SIZE;
+
+  for(i = 0; i < 4; ++i) {
+    delta_history_table[dht_index].last_deltas[i + 1] = delta_history_table[dht_index].last_deltas[i];
+  }
+
+  delta_history_table[dht_index].last_deltas[0] = delta;
+
+  /* Offset Prediction Table */
+  opt_index = (address % PAGE_SIZE) / L2_BLOCK_SIZE;
+
+  if(offset_prediction_table[opt_index].first_access == 0) {
+    offset_prediction_table[opt_index].delta_prediction = 0;
+    offset_prediction_table[opt_index].accuracy = 0;
+    offset_prediction_table[opt_index].first_access = 1;
+  } else {
+    if(offset_prediction_table[opt_index].accuracy == 1) {
+      prefetch_l2_steps(address, offset_prediction_table[opt_index].delta_prediction, cycle);
+    }
+
+    if(address - offset_prediction_table[opt_index].last_address == offset_prediction_table[opt_index].delta_prediction) {
+      offset_prediction_table[opt_index].accuracy = 1;
+    } else {
+      if(offset_prediction_table[opt_index].accuracy == 0) {
+        offset_prediction_table[opt_index].delta_prediction = address - offset_prediction_table[opt_index].last_address;
+      }
+
+      offset_prediction_table[opt_index].accuracy = 0;
+    }
+  }
+
+  offset_prediction_table[opt_index].last_address = address;
+
+  /* Delta Prediction Table */
   for(i = MIN(DELTA_PREDICTION_TABLES, delta_history_table[dht_index].times_used) - 1; i >= 0 && dpt_index == -1; --i) {
     for(j = 0; j < PREDICTION_TABLE_LENGTH && dpt_index == -1; ++j) {
       matches = 0;
@@ -446,77 +1921,420 @@ pae:
     }
   }
 
-  /* Get new prediction */
-  if(dpt_table != -1 && dpt_index != -1) {
-    for(i = 0; i < 4; ++i) {
-      delta_history_table[dht_index].last_prefetched_offsets[i + 1] = delta_history_table[dht_index].last_prefetched_offsets[i];
-    }
+  /* Get new prediction */
+  if(dpt_table != -1 && dpt_index != -1) {
+    for(i = 0; i < 4; ++i) {
+      delta_history_table[dht_index].last_prefetched_offsets[i + 1] = delta_history_table[dht_index].last_prefetched_offsets[i];
+    }
+
+    delta_history_table[dht_index].last_prefetched_offsets[0] = address + delta_prediction_table[dpt_table][dpt_index].prediction;
+    delta_history_table[dht_index].last_predictor = dpt_table;
+    delta_history_table[dht_index].last_index = dpt_index;
+    prefetch_l2_steps(address, delta_prediction_table[dpt_table][dpt_index].prediction, cycle);
+  }
+
+  /* New entry to Delta Prediction Table */
+  if(delta_history_table[dht_index].times_used > 0) {
+    dpt_table = MIN(DELTA_PREDICTION_TABLES, delta_history_table[dht_index].times_used) - 1;
+
+    for(i = 0; i < PREDICTION_TABLE_LENGTH; ++i) {
+      matches = 0;
+
+      for(j = 0; j < dpt_table + 1; ++j) {
+        if(delta_history_table[dht_index].last_deltas[j] == delta_prediction_table[dpt_table][i].deltas[j]) {
+          ++matches;
+        }
+      }
+
+      if(matches == dpt_table + 1) {
+        goto entry_exists; /* Ugly but works! */
+      }
+    }
+
+    do {
+      dpt_index = rand() % PREDICTION_TABLE_LENGTH;
+    } while(delta_prediction_table[dpt_table][dpt_index].nmru == 0);
+
+    for(j = 0; j < PREDICTION_TABLE_LENGTH; ++j) {
+      delta_prediction_table[dpt_table][j].nmru = 1;
+    }
+
+    for(j = 0; j < dpt_table + 1; ++j) {
+      delta_prediction_table[dpt_table][dpt_index].deltas[j] = delta_history_table[dht_index].last_deltas[j];
+    }
+
+    delta_prediction_table[dpt_table][dpt_index].prediction = 0;
+    delta_prediction_table[dpt_table][dpt_index].accuracy = 1;
+  }
+
+entry_exists:
+
+  delta_prediction_table[dpt_table][dpt_index].nmru = 0;
+  delta_history_table[dht_index].times_used++;
+}
+
+/* Best-Offset prefetcher (Michaud, HPCA 2016): learns a single offset D by
+   testing one candidate per trigger against a table of recent requests */
+void best_offset_prefetcher(unsigned long pc, unsigned long address, unsigned long cycle, unsigned int missed_l2) {
+  static unsigned long recent_requests[BO_RR_ENTRIES];
+  static unsigned int offsets[BO_MAX_OFFSETS];
+  static unsigned int scores[BO_MAX_OFFSETS];
+  static unsigned int noffsets = 0, test_index = 0, round = 0;
+  static unsigned int best_offset = 1, prefetch_on = 1;
+  static int initialized = 0;
+  unsigned long line, base, target;
+  unsigned int i, n, best;
+
+  if(initialized == 0) {
+    /* Offsets of the form 2^i * 3^j * 5^k that fit in a page */
+    for(i = 1; i < PAGE_LINES && noffsets < BO_MAX_OFFSETS; ++i) {
+      for(n = i; n % 2 == 0; n /= 2);
+      for(; n % 3 == 0; n /= 3);
+      for(; n % 5 == 0; n /= 5);
+
+      if(n == 1) {
+        offsets[noffsets++] = i;
+      }
+    }
+
+    for(i = 0; i < BO_RR_ENTRIES; ++i) {
+      recent_requests[i] = ~0UL;
+    }
+
+    initialized = 1;
+  }
+
+  if(missed_l2 == 0 && l2_prefetch_hit == 0) {
+    return;
+  }
+
+  line = address / L2_BLOCK_SIZE;
+
+  /* Learning phase: test one offset per trigger */
+  if(line >= offsets[test_index]) {
+    base = line - offsets[test_index];
+
+    if(recent_requests[(base ^ (base >> 8)) % BO_RR_ENTRIES] == base) {
+      ++scores[test_index];
+    }
+  }
+
+  if(++test_index == noffsets) {
+    test_index = 0;
+    ++round;
+  }
+
+  for(best = 0, i = 1; i < noffsets; ++i) {
+    if(scores[i] > scores[best]) {
+      best = i;
+    }
+  }
+
+  if(scores[best] >= BO_SCORE_MAX || round >= BO_ROUND_MAX) {
+    best_offset = offsets[best];
+    prefetch_on = (scores[best] > BO_BAD_SCORE);
+
+    for(i = 0; i < noffsets; ++i) {
+      scores[i] = 0;
+    }
+
+    test_index = 0;
+    round = 0;
+  }
+
+  /* Prefetched lines are considered complete at once, so the base address
+     of the prefetch is recorded as a recent request right away */
+  recent_requests[(line ^ (line >> 8)) % BO_RR_ENTRIES] = line;
+
+  for(i = 0; prefetch_on != 0 && i < prefetch_degree; ++i) {
+    target = line + best_offset * (prefetch_distance + i);
+
+    if(target / PAGE_LINES != line / PAGE_LINES) {
+      break;
+    }
+
+    prefetch_l2_data(target * L2_BLOCK_SIZE, cycle);
+  }
+}
+
+unsigned int spp_next_signature(unsigned int signature, int delta) {
+  unsigned int encoded = (delta < 0) ? ((-delta) & 0x3F) | 0x40 : (delta & 0x3F);
+  return ((signature << 3) ^ encoded) & ((1 << SPP_SIGNATURE_BITS) - 1);
+}
+
+/* Signature Path Prefetcher (Kim et al., MICRO 2016): compresses the delta
+   history of each page into a signature and walks the pattern table ahead
+   while the path confidence stays above the lookahead threshold, the walk
+   depth scales with the prefetch distance */
+void signature_path_prefetcher(unsigned long pc, unsigned long address, unsigned long cycle, unsigned int missed_l2) {
+  static struct signature_table_entry signature_table[SPP_SIGNATURE_TABLE_ENTRIES];
+  static struct pattern_table_entry pattern_table[SPP_PATTERN_TABLE_ENTRIES];
+  struct signature_table_entry *st;
+  struct pattern_table_entry *pt;
+  unsigned long page_number;
+  unsigned int offset, signature, confidence, depth, i, best;
+  int delta, base;
+
+  if(missed_l2 == 0 && l2_prefetch_hit == 0) {
+    return;
+  }
+
+  page_number = get_page_number(address, PAGE_SIZE);
+  offset = (address % PAGE_SIZE) / L2_BLOCK_SIZE;
+  st = &signature_table[page_number % SPP_SIGNATURE_TABLE_ENTRIES];
+
+  if(st->valid == 0 || st->page_number != page_number) {
+    st->valid = 1;
+    st->page_number = page_number;
+    st->signature = spp_next_signature(0, offset);
+  } else {
+    delta = (int) offset - (int) st->last_offset;
+
+    if(delta == 0) {
+      return;
+    }
+
+    /* Update pattern table */
+    pt = &pattern_table[st->signature % SPP_PATTERN_TABLE_ENTRIES];
+
+    if(pt->signature_counter >= SPP_COUNTER_MAX) {
+      pt->signature_counter >>= 1;
+
+      for(i = 0; i < SPP_PATTERN_DELTAS; ++i) {
+        pt->delta_counters[i] >>= 1;
+      }
+    }
+
+    ++pt->signature_counter;
+
+    for(best = 0, i = 0; i < SPP_PATTERN_DELTAS; ++i) {
+      if(pt->delta_counters[i] > 0 && pt->deltas[i] == delta) {
+        break;
+      }
+
+      if(pt->delta_counters[i] < pt->delta_counters[best]) {
+        best = i;
+      }
+    }
+
+    if(i == SPP_PATTERN_DELTAS) {
+      i = best;
+      pt->deltas[i] = delta;
+      pt->delta_counters[i] = 0;
+    }
+
+    ++pt->delta_counters[i];
+    st->signature = spp_next_signature(st->signature, delta);
+  }
+
+  st->last_offset = offset;
+
+  /* Lookahead */
+  signature = st->signature;
+  base = offset;
+  confidence = 100;
+
+  for(depth = 0; depth < SPP_MAX_DEPTH * prefetch_distance; ++depth) {
+    pt = &pattern_table[signature % SPP_PATTERN_TABLE_ENTRIES];
+
+    if(pt->signature_counter == 0) {
+      break;
+    }
+
+    for(best = 0, i = 0; i < SPP_PATTERN_DELTAS; ++i) {
+      if(pt->delta_counters[i] == 0) {
+        continue;
+      }
+
+      if(confidence * pt->delta_counters[i] / pt->signature_counter >= SPP_PREFETCH_THRESHOLD &&
+         base + pt->deltas[i] >= 0 && base + pt->deltas[i] < PAGE_LINES) {
+        prefetch_l2_data((page_number * PAGE_LINES + base + pt->deltas[i]) * L2_BLOCK_SIZE, cycle);
+      }
+
+      if(pt->delta_counters[i] > pt->delta_counters[best]) {
+        best = i;
+      }
+    }
+
+    confidence = confidence * pt->delta_counters[best] / pt->signature_counter;
+
+    if(confidence < SPP_LOOKAHEAD_THRESHOLD || base + pt->deltas[best] < 0 || base + pt->deltas[best] >= PAGE_LINES) {
+      break;
+    }
+
+    base += pt->deltas[best];
+    signature = spp_next_signature(signature, pt->deltas[best]);
+  }
+}
+
+/* Multi-stream stream buffer prefetcher (Jouppi, ISCA 1990): each buffer
+   follows one ascending or descending stream and keeps STREAM_BUFFER_DEPTH
+   lines per unit of prefetch distance ahead of it, issuing at most
+   STREAM_BUFFER_DEPTH lines per unit of degree on each trigger */
+void stream_buffer_prefetcher(unsigned long pc, unsigned long address, unsigned long cycle, unsigned int missed_l2) {
+  static struct stream_buffer_entry stream_buffers[STREAM_BUFFERS];
+  struct stream_buffer_entry *sb;
+  unsigned long line;
+  long distance;
+  unsigned int i, issued, lru;
+
+  if(missed_l2 == 0 && l2_prefetch_hit == 0) {
+    return;
+  }
+
+  line = address / L2_BLOCK_SIZE;
+
+  for(i = 0; i < STREAM_BUFFERS; ++i) {
+    sb = &stream_buffers[i];
+    distance = (long) (line - sb->last_line);
+
+    if(sb->state == STREAM_INVALID || distance == 0 || labs(distance) > STREAM_WINDOW ||
+       (sb->state == STREAM_ACTIVE && (distance > 0) != (sb->direction > 0))) {
+      continue;
+    }
+
+    if(sb->state == STREAM_TRAINING) {
+      sb->direction = (distance > 0) ? 1 : -1;
+      sb->next_line = line + sb->direction;
+      sb->state = STREAM_ACTIVE;
+    }
+
+    if((long) (sb->next_line - line) * sb->direction <= 0) {
+      sb->next_line = line + sb->direction;
+    }
+
+    for(issued = 0; issued < STREAM_BUFFER_DEPTH * prefetch_degree &&
+                    (long) (sb->next_line - line) * sb->direction <= STREAM_BUFFER_DEPTH * prefetch_distance &&
+                    sb->next_line / PAGE_LINES == line / PAGE_LINES; ++issued) {
+      prefetch_l2_data(sb->next_line * L2_BLOCK_SIZE, cycle);
+      sb->next_line += sb->direction;
+    }
+
+    sb->last_line = line;
+    sb->cycle = cycle;
+    return;
+  }
+
+  if(missed_l2 == 0) {
+    return;
+  }
+
+  /* Allocate a new stream on the least recently used buffer */
+  for(lru = 0, i = 0; i < STREAM_BUFFERS; ++i) {
+    if(stream_buffers[i].state == STREAM_INVALID) {
+      lru = i;
+      break;
+    }
+
+    if(stream_buffers[i].cycle < stream_buffers[lru].cycle) {
+      lru = i;
+    }
+  }
+
+  stream_buffers[lru].last_line = line;
+  stream_buffers[lru].next_line = line;
+  stream_buffers[lru].cycle = cycle;
+  stream_buffers[lru].direction = 0;
+  stream_buffers[lru].state = STREAM_TRAINING;
+}
+
+unsigned int latency_bucket(unsigned long latency) {
+  unsigned int shift;
+
+  if(latency < (1UL << LATENCY_SUB_BUCKET_BITS)) {
+    return latency;
+  }
+
+  shift = 63 - __builtin_clzl(latency) - LATENCY_SUB_BUCKET_BITS;
+  return ((shift + 1) << LATENCY_SUB_BUCKET_BITS) + ((latency >> shift) & ((1UL << LATENCY_SUB_BUCKET_BITS) - 1));
+}
 
-    delta_history_table[dht_index].last_prefetched_offsets[0] = address + delta_prediction_table[dpt_table][dpt_index].prediction;
-    delta_history_table[dht_index].last_predictor = dpt_table;
-    delta_history_table[dht_index].last_index = dpt_index;
-    write_l2_data(address + delta_prediction_table[dpt_table][dpt_index].prediction, -1, 0, 1, cycle);
+/* Highest latency falling into bucket */
+unsigned long latency_bucket_limit(unsigned int bucket) {
+  unsigned int shift;
+
+  if(bucket < (1U << LATENCY_SUB_BUCKET_BITS)) {
+    return bucket;
   }
 
-  /* New entry to Delta Prediction Table */
-  if(delta_history_table[dht_index].times_used > 0) {
-    dpt_table = MIN(DELTA_PREDICTION_TABLES, delta_history_table[dht_index].times_used) - 1;
+  shift = (bucket >> LATENCY_SUB_BUCKET_BITS) - 1;
+  return (((bucket & ((1UL << LATENCY_SUB_BUCKET_BITS) - 1)) | (1UL << LATENCY_SUB_BUCKET_BITS)) << shift) + (1UL << shift) - 1;
+}
 
-    for(i = 0; i < PREDICTION_TABLE_LENGTH; ++i) {
-      matches = 0;
+void record_latency(unsigned int class, unsigned long latency) {
+  unsigned int bucket = latency_bucket(latency);
 
-      for(j = 0; j < dpt_table + 1; ++j) {
-        if(delta_history_table[dht_index].last_deltas[j] == delta_prediction_table[dpt_table][i].deltas[j]) {
-          ++matches;
-        }
-      }
+  ++latency_histograms[class].counts[bucket];
+  ++latency_histograms[class].total;
+  ++interval_histograms[class].counts[bucket];
+  ++interval_histograms[class].total;
 
-      if(matches == dpt_table + 1) {
-        goto entry_exists; /* Ugly but works! */
-      }
-    }
+  if(latency > latency_histograms[class].max) {
+    latency_histograms[class].max = latency;
+  }
 
-    do {
-      dpt_index = rand() % PREDICTION_TABLE_LENGTH;
-    } while(delta_prediction_table[dpt_table][dpt_index].nmru == 0);
+  if(latency > interval_histograms[class].max) {
+    interval_histograms[class].max = latency;
+  }
+}
 
-    for(j = 0; j < PREDICTION_TABLE_LENGTH; ++j) {
-      delta_prediction_table[dpt_table][j].nmru = 1;
-    }
+/* Records a demand access by type and by the level that served it */
+void record_access_latency(int store, unsigned int level, unsigned long latency) {
+  record_latency(store ? LATENCY_STORE : LATENCY_LOAD, latency);
+  record_latency(level, latency);
 
-    for(j = 0; j < dpt_table + 1; ++j) {
-      delta_prediction_table[dpt_table][dpt_index].deltas[j] = delta_history_table[dht_index].last_deltas[j];
-    }
+  if(l2_prefetch_hit != 0) {
+    record_latency(LATENCY_PREFETCH_HIT, latency);
+  }
+}
 
-    delta_prediction_table[dpt_table][dpt_index].prediction = 0;
-    delta_prediction_table[dpt_table][dpt_index].accuracy = 1;
+unsigned long latency_percentile(struct latency_histogram *histogram, unsigned int per_mille) {
+  unsigned long long target, count = 0;
+  unsigned int i;
+
+  target = (histogram->total * per_mille + 999) / 1000;
+
+  for(i = 0; i < LATENCY_BUCKETS; ++i) {
+    if((count += histogram->counts[i]) >= target) {
+      return MIN(latency_bucket_limit(i), histogram->max);
+    }
   }
 
-entry_exists:
+  return histogram->max;
+}
 
-  delta_prediction_table[dpt_table][dpt_index].nmru = 0;
-  delta_history_table[dht_index].times_used++;
+void print_latency_histograms(struct latency_histogram histograms[], const char *prefix) {
+  static const char *names[LATENCY_CLASSES] = { "Load", "Store", "Prefetch Hit", "L1 Hit", "L2 Hit", "Memory" };
+  unsigned int i;
+
+  for(i = 0; i < LATENCY_CLASSES; ++i) {
+    if(histograms[i].total > 0) {
+      fprintf(stdout, "%s%s Latency p50/p90/p99/p99.9/Max: %lu/%lu/%lu/%lu/%lu\n", prefix, names[i],
+              latency_percentile(&histograms[i], 500), latency_percentile(&histograms[i], 900),
+              latency_percentile(&histograms[i], 990), latency_percentile(&histograms[i], 999), histograms[i].max);
+    }
+  }
 }
 
 int get_opcode(const char *filename, char *assembly, char *opcode, unsigned long *address, unsigned long *read_register1,
                unsigned long *read_register2, unsigned long *write_register){
-  static FILE *file = NULL;
   char *sub_string = NULL;
   char *tmp_ptr = NULL;
   char buf[CHUNK];
   int i = 0, count = 0;
 
+  SELF_PROFILE_SWITCH(SELF_PARSE);
   srand(time(NULL));
 
-  if(file == NULL) {
-    file = fopen(filename, "r");
-    if(file == NULL) {
+  if(trace_file == NULL) {
+    trace_file = fopen(filename, "r");
+    if(trace_file == NULL) {
       printf("Could not open file.\n");
       exit(1);
     }
   }
 
-  if(!fgets(buf, sizeof buf, file)) {
+  if(!fgets(buf, sizeof buf, trace_file)) {
     return (0);
   }
 
@@ -560,37 +2378,429 @@ int get_opcode(const char *filename, char *assembly, char *opcode, unsigned long
   return 1;
 }
 
+/* Extrapolates L2 misses from the sampled sets with 95% confidence intervals.
+   The sample is systematic (every 2^shift-th set), the intervals treat it as
+   a random one, which holds while addresses are spread evenly over the sets */
+void print_l2_sampling(unsigned long l2_hit, unsigned long l2_miss) {
+  unsigned long sets = L2_SETS >> l2_sample_shift, i;
+  double fraction = 1.0 / (1UL << l2_sample_shift), ratio, mean_misses, mean_accesses;
+  double misses_variance = 0, ratio_variance = 0;
+
+  mean_misses = (double) l2_miss / sets;
+  mean_accesses = (double) (l2_hit + l2_miss) / sets;
+  ratio = (l2_hit + l2_miss > 0) ? ((double) l2_miss / (l2_hit + l2_miss)) : 0;
+
+  for(i = 0; i < sets; ++i) {
+    misses_variance += (l2_sample_misses[i] - mean_misses) * (l2_sample_misses[i] - mean_misses);
+    ratio_variance += (l2_sample_misses[i] - ratio * l2_sample_accesses[i]) * (l2_sample_misses[i] - ratio * l2_sample_accesses[i]);
+  }
+
+  misses_variance /= sets - 1;
+  ratio_variance /= sets - 1;
+
+  fprintf(stdout, "L2 Sampled Sets: %lu/%lu (systematic sample, treated as random)\n", sets, (unsigned long) L2_SETS);
+  fprintf(stdout, "L2 Miss Estimate: %.0f +/- %.0f\n", (double) l2_miss / fraction,
+          1.96 * L2_SETS * sqrt((1 - fraction) * misses_variance / sets));
+  fprintf(stdout, "L2 Miss Ratio Estimate: %.6f +/- %.6f\n", ratio,
+          (mean_accesses > 0) ? (1.96 * sqrt((1 - fraction) * ratio_variance / sets) / mean_accesses) : 0.0);
+}
+
+void usage(const char *program) {
+  fprintf(stderr, "Usage: %s [options] <trace file>\n", program);
+  fprintf(stderr, "  -v               Print every trace record\n");
+  fprintf(stderr, "  -d degree        Prefetch degree\n");
+  fprintf(stderr, "  -D distance      Prefetch distance\n");
+  fprintf(stderr, "  -f               Feedback directed prefetch throttling\n");
+  fprintf(stderr, "  -w file          Write an L1-filtered trace (L1 stage only)\n");
+  fprintf(stderr, "  -r               Replay an L1-filtered trace into L2\n");
+  fprintf(stderr, "  -m               Banked DRAM model\n");
+  fprintf(stderr, "  -M key=value,... Banked DRAM model with the given parameters\n");
+  fprintf(stderr, "  -n l1,l2         Number of MSHRs per level\n");
+  fprintf(stderr, "  -o rob,width     Out-of-order window with ROB size and issue width\n");
+  fprintf(stderr, "  -W back|through[,noalloc]\n");
+  fprintf(stderr, "                   L1 write policy, write-back with write-allocate by default\n");
+  fprintf(stderr, "  -b depth         Write buffer depth\n");
+  fprintf(stderr, "  -i none|nextline|fdip\n");
+  fprintf(stderr, "                   Simulate L1I from the trace PCs with the given prefetcher\n");
+  fprintf(stderr, "  -t 4k|2m         Simulate data address translation with the given page size\n");
+  fprintf(stderr, "  -l interval      Access latency percentiles, also every interval records if not 0\n");
+  fprintf(stderr, "  -p size[,top]    Profile accesses, L2 misses and prefetch fills per region of size bytes\n");
+  fprintf(stderr, "  -P file          Write the region profile heatmap (cycle, region, accesses, misses, fills)\n");
+  fprintf(stderr, "  -s shift         Simulate one in 2^shift L2 sets and extrapolate L2 hits and misses\n");
+  fprintf(stderr, "  -k first[,count] Simulate count records (all by default) from record first, seeking with the trace index\n");
+  fprintf(stderr, "  -I               Print the trace index summary, indexing the trace if needed\n");
+  exit(EXIT_FAILURE);
+}
+
 int main(int argc, char *const *argv) {
   char assembly[20];
   char opcode[20];
   double miss_rate, prefetch_rate;
-  int verbose = 0;
+  int verbose = 0, feedback = 0, replay = 0, dram_model = 0, nonblocking = 0;
+  int write_back = 1, write_allocate = 1, iprefetcher = IPREFETCH_DISABLED, histograms = 0;
+  int profiling = 0, windowed = 0, index_summary = 0;
+  struct trace_index index;
   int opt;
+  struct filtered_trace_header header;
+  struct filtered_trace_record record;
   unsigned int way;
   unsigned long address;
   unsigned long read_register1, read_register2, write_register, missed_l2;
   unsigned long l1_hit = 0, l1_miss = 0, l2_hit = 0, l2_miss = 0;
-  unsigned long cycles = 0, penalty = 0;
-
-  while((opt = getopt(argc, argv, "v")) != -1) {
+  unsigned long l1i_hit = 0, l1i_miss = 0, fetch_line = ~0UL;
+  unsigned long cycles = 0, penalty = 0, victim, fetch_start;
+  unsigned long *retire_cycles = NULL, dispatch_cycle = 0, retire_cycle = 0, instructions = 0;
+  unsigned int rob_size = 0, issue_width = ISSUE_WIDTH, dispatched = 0, retired = 0, mshr;
+  unsigned long walk[PAGE_TABLE_LEVELS], translation, walk_start;
+  unsigned int walk_references, walk_level, served = LATENCY_L1, top_regions = PROFILE_TOP_REGIONS;
+  unsigned long access_start, latency_interval = 0, records = 0, intervals = 0;
+  char interval_prefix[32];
+  unsigned long window_first = 0, window_count = 0, trace_records = 0;
+  struct run_config config;
+
+  while((opt = getopt(argc, argv, "vd:D:fw:rmM:n:o:W:b:i:t:l:p:P:s:k:I")) != -1) {
     switch(opt) {
       case 'v':
         verbose = 1;
         break;
+      case 'd':
+        if(optarg[0] == '-' || sscanf(optarg, "%u", &prefetch_degree) != 1 || prefetch_degree > PREFETCH_MAX) {
+          usage(argv[0]);
+        }
+
+        break;
+      case 'D':
+        if(optarg[0] == '-' || sscanf(optarg, "%u", &prefetch_distance) != 1 || prefetch_distance > PREFETCH_MAX) {
+          usage(argv[0]);
+        }
+
+        break;
+      case 'f':
+        feedback = 1;
+        prefetch_degree = throttle_degrees[FDP_INITIAL_LEVEL];
+        prefetch_distance = throttle_distances[FDP_INITIAL_LEVEL];
+        break;
+      case 'w':
+        filtered_trace = fopen(optarg, "wb");
+        if(filtered_trace == NULL) {
+          fprintf(stderr, "Could not open file.\n");
+          exit(EXIT_FAILURE);
+        }
+
+        write_filtered_header(0, 0, 0, 0, 0);
+        break;
+      case 'r':
+        replay = 1;
+        break;
+      case 'M':
+        parse_dram_config(optarg);
+        /* Fall through */
+      case 'm':
+        dram_model = 1;
+        break;
+      case 'n':
+        if(sscanf(optarg, "%u,%u", &l1_mshrs.size, &l2_mshrs.size) != 2 || l1_mshrs.size == 0 || l2_mshrs.size == 0) {
+          usage(argv[0]);
+        }
+
+        nonblocking = 1;
+        break;
+      case 'o':
+        if(sscanf(optarg, "%u,%u", &rob_size, &issue_width) != 2 || rob_size == 0 || issue_width == 0) {
+          usage(argv[0]);
+        }
+
+        nonblocking = 1;
+        break;
+      case 'W':
+        write_back = (strncmp(optarg, "through", 7) != 0);
+        write_allocate = (strstr(optarg, "noalloc") == NULL);
+
+        if(strncmp(optarg, "back", 4) != 0 && write_back != 0) {
+          usage(argv[0]);
+        }
+        break;
+      case 'b':
+        if((write_buffer.depth = atoi(optarg)) == 0) {
+          usage(argv[0]);
+        }
+        break;
+      case 'i':
+        if(strcmp(optarg, "none") == 0) {
+          iprefetcher = IPREFETCH_NONE;
+        } else if(strcmp(optarg, "nextline") == 0) {
+          iprefetcher = IPREFETCH_NEXT_LINE;
+        } else if(strcmp(optarg, "fdip") == 0) {
+          iprefetcher = IPREFETCH_FETCH_DIRECTED;
+        } else {
+          usage(argv[0]);
+        }
+        break;
+      case 't':
+        if(strcmp(optarg, "4k") == 0) {
+          page_shift = SMALL_PAGE_SHIFT;
+        } else if(strcmp(optarg, "2m") == 0) {
+          page_shift = HUGE_PAGE_SHIFT;
+        } else {
+          usage(argv[0]);
+        }
+        break;
+      case 'l':
+        latency_interval = strtoul(optarg, NULL, 10);
+        histograms = 1;
+        break;
+      case 'p':
+        if(sscanf(optarg, "%lu,%u", &profile.region_size, &top_regions) < 1 || profile.region_size == 0) {
+          usage(argv[0]);
+        }
+
+        profiling = 1;
+        break;
+      case 'k':
+        if(sscanf(optarg, "%lu,%lu", &window_first, &window_count) < 1) {
+          usage(argv[0]);
+        }
+
+        windowed = 1;
+        break;
+      case 'I':
+        index_summary = 1;
+        break;
+      case 's':
+        l2_sample_shift = atoi(optarg);
+
+        if(l2_sample_shift >= 8 * sizeof(unsigned long) || (L2_SETS >> l2_sample_shift) < 2) {
+          usage(argv[0]);
+        }
+        break;
+      case 'P':
+        if((profile.heatmap = fopen(optarg, "w")) == NULL) {
+          fprintf(stderr, "Could not open file.\n");
+          exit(EXIT_FAILURE);
+        }
+
+        profiling = 1;
+        break;
       default:
-        fprintf(stderr, "Usage: %s [-v] <trace file>\n", argv[0]);
-        exit(EXIT_FAILURE);
+        usage(argv[0]);
     }
   }
 
   if(optind >= argc) {
-    fprintf(stderr, "Usage: %s [-v] <trace file>\n", argv[0]);
+    usage(argv[0]);
+  }
+
+  if(filtered_trace != NULL && replay != 0) {
+    fprintf(stderr, "Options -w and -r are mutually exclusive.\n");
     exit(EXIT_FAILURE);
   }
 
-  while(get_opcode(argv[optind], assembly, opcode, &address, &read_register1, &read_register2, &write_register)) {
-    ++cycles;
+  if(rob_size > 0 && (filtered_trace != NULL || replay != 0)) {
+    fprintf(stderr, "Option -o needs a full trace.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(histograms != 0 && (filtered_trace != NULL || replay != 0)) {
+    fprintf(stderr, "Option -l needs a full trace.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(profiling != 0 && (filtered_trace != NULL || replay != 0)) {
+    fprintf(stderr, "Options -p and -P need a full trace.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if((windowed != 0 || index_summary != 0) && replay != 0) {
+    fprintf(stderr, "Options -k and -I need a text trace.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(windowed != 0 || index_summary != 0) {
+    trace_index_load(argv[optind], TRACE_OPCODE_FIELD, TRACE_ADDRESS_FIELDS, &index);
+
+    if(index_summary != 0) {
+      trace_index_print(&index);
+      return 0;
+    }
+
+    trace_file = trace_index_open(argv[optind], &index, window_first);
+  }
+
+  /* Runs writing files, printing every record or profiling the simulator are not memoized */
+  self_profile_init();
+
+  memset(&config, 0, sizeof config);
+  config.prefetch_degree = prefetch_degree;
+  config.prefetch_distance = prefetch_distance;
+  config.feedback = feedback;
+  config.replay = replay;
+  config.dram_model = dram_model;
+  config.write_back = write_back;
+  config.write_allocate = write_allocate;
+  config.write_buffer_depth = write_buffer.depth;
+  config.iprefetcher = iprefetcher;
+  config.page_shift = page_shift;
+  config.histograms = histograms;
+  config.latency_interval = latency_interval;
+  config.l2_sample_shift = l2_sample_shift;
+
+  if(dram_model != 0) {
+    config.dram = dram;
+  }
+
+  if(nonblocking != 0) {
+    config.l1_mshrs = l1_mshrs.size;
+    config.l2_mshrs = l2_mshrs.size;
+    config.rob_size = rob_size;
+    config.issue_width = (rob_size > 0) ? issue_width : 0;
+  }
+
+  if(profiling != 0) {
+    config.region_size = profile.region_size;
+    config.top_regions = top_regions;
+  }
+
+  if(windowed != 0) {
+    config.windowed = 1;
+    config.window_first = window_first;
+    config.window_count = window_count;
+  }
+
+  if(verbose == 0 && filtered_trace == NULL && profile.heatmap == NULL && self_profiling == 0 &&
+     results_store_open(argv[optind], argv[0], &config, sizeof config) != 0) {
+    return 0;
+  }
+
+  init_l2();
+
+  /* Blocking runs wait for every miss, there is nothing to track */
+  if(nonblocking != 0) {
+    init_mshrs(&l1_mshrs);
+    init_mshrs(&l2_mshrs);
+  }
+
+  init_write_buffer();
+
+  if(dram_model != 0) {
+    init_dram();
+  }
+
+  if(page_shift != 0) {
+    init_translation();
+  }
+
+  if(profiling != 0) {
+    init_profile();
+  }
+
+  if(rob_size > 0 && (retire_cycles = calloc(rob_size, sizeof(unsigned long))) == NULL) {
+    fprintf(stderr, "Could not allocate ROB.\n");
+    exit(EXIT_FAILURE);
+  }
+
+#ifndef L2_LOOKUP
+#define L2_LOOKUP(mem)      SELF_PROFILE_ENTER(SELF_L2);                                            \
+                            dram_tick(cycles);                                                      \
+                            if(!L2_SAMPLED(mem)) {                                                  \
+                              /* Unsampled set, charged as a hit */                                 \
+                            } else if(fetch_data_from_l2(mem, &way, cycles,                         \
+                                                         &penalty) == FETCH_MISS) {                 \
+                              mshr = mshr_allocate(&l2_mshrs, &cycles);                             \
+                              cycles = dram_read(mem, cycles, 0);                                   \
+                              mshr_fill(&l2_mshrs, mshr, cycles);                                   \
+                              ++l2_miss;                                                            \
+                              missed_l2 = 1;                                                        \
+                              write_l2_data(mem, 0, 0, cycles);                                     \
+                            } else {                                                                \
+                              l2_mshrs.merges += (penalty > 0);                                     \
+                              ++l2_hit;                                                             \
+                            }                                                                       \
+                                                                                                    \
+                            cycles += L2_LATENCY + penalty;                                         \
+                            penalty = 0;                                                            \
+                            SELF_PROFILE_LEAVE();
+#endif
+
+#ifndef L2_PREFETCH
+#define L2_PREFETCH(pc, mem)  SELF_PROFILE_ENTER(SELF_PREFETCHER);                                  \
+                              CACHE_PREFETCHER(pc, mem, cycles, missed_l2);                         \
+                                                                                                    \
+                              if(feedback != 0) {                                                   \
+                                throttle_prefetcher(l2_miss);                                       \
+                              }                                                                     \
+                                                                                                    \
+                              SELF_PROFILE_LEAVE();
+#endif
+
+  /* Replay an L1-filtered trace straight into the L2 stage */
+  while(replay != 0 && get_filtered_record(argv[optind], &header, &record)) {
+    SELF_PROFILE_RECORD();
+    ++trace_records;
+    cycles += record.cycles;
     missed_l2 = 0;
+    l2_prefetch_hit = 0;
+
+    if(record.type == FILTERED_L1_WRITEBACK) {
+      cycles = write_buffer_insert(record.address, cycles);
+      continue;
+    }
+
+    if(record.type == FILTERED_L1I_MISS) {
+      L2_LOOKUP(record.address);
+      continue;
+    }
+
+    if(record.type == FILTERED_L1I_PREFETCH) {
+      fetch_instruction_line(record.address, cycles);
+      continue;
+    }
+
+    if(record.type == FILTERED_L1_WALK_MISS) {
+      L2_LOOKUP(record.address);
+      cycles += L1_LATENCY;
+      continue;
+    }
+
+    L2_LOOKUP(record.address);
+    cycles += L1_LATENCY;
+    L2_PREFETCH(record.pc, record.address);
+  }
+
+  if(replay != 0) {
+    cycles += header.tail_cycles;
+    l1_hit = header.l1_hit;
+    l1_miss = header.l1_miss;
+    l1_writebacks = header.l1_writebacks;
+    l1i_hit = header.l1i_hit;
+    l1i_miss = header.l1i_miss;
+    useful_instruction_prefetches = header.l1i_useful_prefetches;
+    total_instruction_prefetches = header.l1i_total_prefetches;
+    page_shift = header.page_shift;
+    dtlb.hits = header.dtlb_hits;
+    dtlb.misses = header.dtlb_misses;
+    stlb.hits = header.stlb_hits;
+    stlb.misses = header.stlb_misses;
+    page_walks = header.page_walks;
+    page_walk_references = header.page_walk_references;
+    page_walk_caches[0].hits = header.page_walk_cache_hits;
+  }
+
+  while(replay == 0 && (window_count == 0 || trace_records < window_count) && get_opcode(argv[optind], assembly, opcode, &address, &read_register1, &read_register2, &write_register)) {
+    SELF_PROFILE_RECORD();
+    ++trace_records;
+
+    /* Out-of-order window: an instruction dispatches once the front end has
+       a free slot and the instruction rob_size places older has retired */
+    if(rob_size > 0) {
+      if(retire_cycles[instructions % rob_size] > dispatch_cycle) {
+        dispatch_cycle = retire_cycles[instructions % rob_size];
+        dispatched = 0;
+      }
+
+      cycles = dispatch_cycle;
+    }
+
+    ++cycles;
 
     if(verbose != 0) {
       printf(" Asm:%s", assembly);
@@ -602,56 +2812,180 @@ int main(int argc, char *const *argv) {
       printf("\n");
     }
 
+#ifndef L1_WRITE_OUT
+#define L1_WRITE_OUT(mem)   if(filtered_trace != NULL) {                                            \
+                              write_filtered_record(address, mem, cycles, FILTERED_L1_WRITEBACK);   \
+                            } else {                                                                \
+                              cycles = write_buffer_insert(mem, cycles);                            \
+                            }
+#endif
+
 #ifndef CACHE_LOOKUP
-#define CACHE_LOOKUP(mem)   if(mem != 0) {                                                          \
-                              if(fetch_data_from_l1(mem, &way, cycles, &penalty) == FETCH_MISS) {   \
-                                if(fetch_data_from_l2(mem, &way, cycles, &penalty) == FETCH_MISS) { \
-                                  cycles += DRAM_LATENCY + penalty;                                 \
-                                  ++l2_miss;                                                        \
-                                  missed_l2 = 1;                                                    \
-                                  write_l2_data(mem, -1, 0, 0, cycles);                             \
+#define CACHE_LOOKUP(mem, store, train)                                                             \
+                            if(mem != 0) {                                                          \
+                              SELF_PROFILE_ENTER(SELF_L1);                                          \
+                              missed_l2 = 0;                                                        \
+                              l2_prefetch_hit = 0;                                                  \
+                              access_start = cycles;                                                \
+                              served = LATENCY_L1;                                                  \
+                              if(fetch_data_from_l1(mem, &way, cycles, &penalty) == FETCH_HIT) {    \
+                                l1_mshrs.merges += (penalty > 0);                                   \
+                                ++l1_hit;                                                           \
+                                                                                                    \
+                                if(store && write_back) {                                           \
+                                  mark_l1_dirty(mem, way);                                          \
+                                }                                                                   \
+                              } else if(store && !write_allocate) {                                 \
+                                ++l1_miss;                                                          \
+                                                                                                    \
+                                /* Not allocated, so written out even under write-back */           \
+                                if(write_back) {                                                    \
+                                  L1_WRITE_OUT(mem);                                                \
+                                }                                                                   \
+                              } else {                                                              \
+                                if(filtered_trace == NULL) {                                        \
+                                  mshr = mshr_allocate(&l1_mshrs, &cycles);                         \
+                                  L2_LOOKUP(mem);                                                   \
+                                  mshr_fill(&l1_mshrs, mshr, cycles);                               \
+                                  served = missed_l2 ? LATENCY_MEMORY : LATENCY_L2;                 \
                                 } else {                                                            \
-                                  ++l2_hit;                                                         \
-                                  write_l1_data(mem, -1, 0, cycles);                                \
+                                  write_filtered_record(address, mem, cycles, (train) ?             \
+                                                        FILTERED_L1_MISS : FILTERED_L1_WALK_MISS);  \
                                 }                                                                   \
                                                                                                     \
-                                cycles += L2_LATENCY + penalty;                                     \
+                                victim = write_l1_data(mem, -1, store && write_back, cycles);       \
                                 ++l1_miss;                                                          \
-                              } else {                                                              \
-                                ++l1_hit;                                                           \
+                                                                                                    \
+                                if(victim != 0) {                                                   \
+                                  ++l1_writebacks;                                                  \
+                                  L1_WRITE_OUT(victim);                                             \
+                                }                                                                   \
+                              }                                                                     \
+                                                                                                    \
+                              if(store && !write_back) {                                            \
+                                L1_WRITE_OUT(mem);                                                  \
                               }                                                                     \
                                                                                                     \
                               cycles += L1_LATENCY + penalty;                                       \
-                              CACHE_PREFETCHER(address, mem, cycles, missed_l2);                    \
+                                                                                                    \
+                              if(histograms != 0 && train) {                                        \
+                                record_access_latency(store, served, cycles - access_start);        \
+                              }                                                                     \
+                                                                                                    \
+                              if(profiling != 0 && train) {                                         \
+                                profile_event(mem, cycles, 1, missed_l2, 0);                        \
+                              }                                                                     \
+                                                                                                    \
+                              SELF_PROFILE_LEAVE();                                                 \
+                                                                                                    \
+                              if(filtered_trace == NULL && train) {                                 \
+                                L2_PREFETCH(address, mem);                                          \
+                              }                                                                     \
+                            }
+#endif
+
+/* Page walk reads go through L1 and L2 but do not train the prefetcher */
+#ifndef TRANSLATE
+#define TRANSLATE(mem)      if(mem != 0 && page_shift != 0) {                                       \
+                              SELF_PROFILE_ENTER(SELF_L1);                                          \
+                              walk_references = translate_address(mem, &translation, walk);         \
+                              cycles += translation;                                                \
+                              walk_start = cycles;                                                  \
+                                                                                                    \
+                              for(walk_level = 0; walk_level < walk_references; ++walk_level) {     \
+                                CACHE_LOOKUP(walk[walk_level], 0, 0);                               \
+                              }                                                                     \
+                                                                                                    \
+                              page_walk_cycles += cycles - walk_start;                              \
+                              SELF_PROFILE_LEAVE();                                                 \
                             }
 #endif
 
-    CACHE_LOOKUP(read_register1);
-    CACHE_LOOKUP(read_register2);
-    CACHE_LOOKUP(write_register);
+    /* Instruction fetch, L1I is looked up once per fetched line */
+    if(iprefetcher != IPREFETCH_DISABLED && address / L1I_BLOCK_SIZE == fetch_line) {
+      ++l1i_hit;
+    } else if(iprefetcher != IPREFETCH_DISABLED) {
+      fetch_start = cycles;
+      SELF_PROFILE_ENTER(SELF_L1);
 
-/*
-    if(write_register != 0) {
-      if(fetch_data_from_l1(write_register, &way) == FETCH_MISS) {
-        if(fetch_data_from_l2(write_register, &way) == FETCH_MISS) {
-          cycles += DRAM_LATENCY; // Needed?
-          ++l2_miss;              // Needed?
-          write_l2_data(write_register, -1, 1, cycles);
+      if(fetch_instruction_from_l1i(address, cycles, &penalty) == FETCH_MISS) {
+        if(filtered_trace != NULL) {
+          write_filtered_record(address, address, cycles, FILTERED_L1I_MISS);
         } else {
-          ++l2_hit;
-          write_l1_data(write_register, -1, 1, cycles);
+          L2_LOOKUP(address);
         }
-        cycles += L2_LATENCY;
-        ++l1_miss;
+
+        write_l1i_data(address, 0, cycles);
+        ++l1i_miss;
       } else {
-        ++l1_hit;
-        write_l1_data(write_register, way, 1, cycles);
+        cycles += penalty;
+        ++l1i_hit;
+      }
+
+      penalty = 0;
+      SELF_PROFILE_LEAVE();
+
+      SELF_PROFILE_ENTER(SELF_PREFETCHER);
+      instruction_prefetcher(iprefetcher, address / L1I_BLOCK_SIZE, fetch_line, cycles);
+      SELF_PROFILE_LEAVE();
+      fetch_line = address / L1I_BLOCK_SIZE;
+
+      /* Front end bubble */
+      if(rob_size > 0) {
+        dispatch_cycle += cycles - fetch_start;
       }
-      cycles += L1_LATENCY;
-      CACHE_PREFETCHER(address, write_register, cycles);
     }
-*/
 
+    TRANSLATE(read_register1);
+    CACHE_LOOKUP(read_register1, 0, 1);
+    TRANSLATE(read_register2);
+    CACHE_LOOKUP(read_register2, 0, 1);
+    TRANSLATE(write_register);
+    CACHE_LOOKUP(write_register, 1, 1);
+
+    /* In order retirement, issue_width instructions per cycle */
+    if(rob_size > 0) {
+      if(cycles > retire_cycle) {
+        retire_cycle = cycles;
+        retired = 0;
+      } else if(++retired == issue_width) {
+        ++retire_cycle;
+        retired = 0;
+      }
+
+      retire_cycles[instructions++ % rob_size] = retire_cycle;
+
+      if(++dispatched == issue_width) {
+        ++dispatch_cycle;
+        dispatched = 0;
+      }
+    }
+
+    if(latency_interval > 0 && ++records % latency_interval == 0) {
+      snprintf(interval_prefix, sizeof interval_prefix, "Interval %lu ", intervals++);
+      print_latency_histograms(interval_histograms, interval_prefix);
+      memset(interval_histograms, 0, sizeof interval_histograms);
+    }
+  }
+
+  SELF_PROFILE_SWITCH(SELF_OTHER);
+
+  if(rob_size > 0) {
+    cycles = retire_cycle;
+  }
+
+  write_buffer_drain(~0UL);
+
+  if(filtered_trace != NULL) {
+    write_filtered_header(l1_hit, l1_miss, l1i_hit, l1i_miss, cycles - filtered_cycles);
+    fclose(filtered_trace);
+    fprintf(stdout, "Filtered Records: %lu\n", filtered_records);
+  }
+
+  if(l2_sample_shift > 0) {
+    print_l2_sampling(l2_hit, l2_miss);
+    l2_hit <<= l2_sample_shift;
+    l2_miss <<= l2_sample_shift;
   }
 
   miss_rate = ((double) l1_miss + (double) l2_miss) / (l1_miss + l2_miss + l1_hit + l2_hit);
@@ -661,5 +2995,70 @@ int main(int argc, char *const *argv) {
   fprintf(stdout, "Prefetches Used/Total: %llu/%llu\n", useful_prefetches, total_prefetches);
   fprintf(stdout, "Miss Rate: %.6f\n", miss_rate);
   fprintf(stdout, "Prefetch Rate: %.6f\n", prefetch_rate);
+
+  if(iprefetcher != IPREFETCH_DISABLED || (replay != 0 && l1i_hit + l1i_miss > 0)) {
+    fprintf(stdout, "L1I Hit/Miss: %lu/%lu\n", l1i_hit, l1i_miss);
+    fprintf(stdout, "L1I Prefetches Used/Total: %llu/%llu\n", useful_instruction_prefetches, total_instruction_prefetches);
+  }
+
+  if(page_shift != 0) {
+    fprintf(stdout, "Page Size: %luKB\n", (1UL << page_shift) / 1024);
+    fprintf(stdout, "DTLB Hit/Miss: %llu/%llu\n", dtlb.hits, dtlb.misses);
+    fprintf(stdout, "STLB Hit/Miss: %llu/%llu\n", stlb.hits, stlb.misses);
+    fprintf(stdout, "Page Walks/References: %llu/%llu\n", page_walks, page_walk_references);
+    fprintf(stdout, "Page Walk Cache Hits: %lu\n", page_walk_cache_hits());
+
+    if(replay == 0) {
+      fprintf(stdout, "Page Walk Cycles: %llu\n", page_walk_cycles);
+    }
+  }
+
+  if(L2_SECTOR_BLOCKS > 1) {
+    fprintf(stdout, "L2 Sectors/Blocks per Sector: %lu/%d\n", (unsigned long) L2_SETS * L2_WAYS, L2_SECTOR_BLOCKS);
+    fprintf(stdout, "L2 Partial Sector Misses: %llu\n", l2_sector_misses);
+  }
+
+  fprintf(stdout, "Writebacks L1/L2: %llu/%llu\n", l1_writebacks, l2_writebacks);
+  fprintf(stdout, "Write Buffer Coalesced/Full Stalls: %llu/%llu\n", write_buffer.coalesced, write_buffer.full_stalls);
+
+  if(dram_model != 0) {
+    fprintf(stdout, "DRAM Writes: %llu\n", dram_writes);
+    fprintf(stdout, "DRAM Demand/Prefetch Reads: %llu/%llu\n", dram_demand_reads, dram_prefetch_reads);
+    fprintf(stdout, "DRAM Row Hit/Miss/Conflict: %llu/%llu/%llu\n", dram_row_hits, dram_row_misses, dram_row_conflicts);
+    fprintf(stdout, "DRAM Dropped Prefetches: %llu\n", dram_dropped_prefetches);
+    fprintf(stdout, "DRAM Average Demand Latency: %.2f\n",
+            (dram_demand_reads > 0) ? ((double) dram_demand_latency / dram_demand_reads) : 0.0);
+  }
+
+  if(nonblocking != 0) {
+    fprintf(stdout, "L1 MSHR Misses/Merges/Full Stalls: %llu/%llu/%llu\n", l1_mshrs.allocations, l1_mshrs.merges, l1_mshrs.full_stalls);
+    fprintf(stdout, "L2 MSHR Misses/Merges/Full Stalls: %llu/%llu/%llu\n", l2_mshrs.allocations, l2_mshrs.merges, l2_mshrs.full_stalls);
+    fprintf(stdout, "MSHR Stall Cycles: %llu\n", l1_mshrs.stall_cycles + l2_mshrs.stall_cycles);
+    fprintf(stdout, "MSHR Dropped Prefetches: %llu\n", mshr_dropped_prefetches);
+  }
+
+  if(rob_size > 0) {
+    fprintf(stdout, "IPC: %.6f\n", (cycles > 0) ? ((double) instructions / cycles) : 0.0);
+  }
+
+  if(histograms != 0) {
+    print_latency_histograms(latency_histograms, "");
+  }
+
+  if(profiling != 0) {
+    print_profile(top_regions);
+
+    if(profile.heatmap != NULL) {
+      fclose(profile.heatmap);
+    }
+  }
+
+  if(feedback != 0) {
+    fprintf(stdout, "Late/Polluting Prefetches: %llu/%llu\n", late_prefetches, polluting_misses);
+    fprintf(stdout, "Final Degree/Distance: %u/%u\n", prefetch_degree, prefetch_distance);
+  }
+
+  self_profile_report(trace_records);
+  results_store_close();
   return 0;
 }
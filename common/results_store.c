@@ -0,0 +1,205 @@
+/*
+ * Simulation Results Store
+ *
+ * Copyright (C) 2016  Mateus Ravedutti Lucio Machado
+ *                     Rafael Ravedutti Lucio Machado
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "results_store.h"
+
+/* Each result is a file named <trace hash>-<configuration hash>-<build hash>
+   holding the output of the run. A new build of a simulator never finds
+   the results of the previous one, which are removed when it stores its
+   own */
+
+#define FNV_OFFSET_BASIS     0xCBF29CE484222325UL
+#define FNV_PRIME            0x100000001B3UL
+#define STORE_CHUNK          65536
+#define STORE_PATH_SIZE      4096
+
+static FILE *captured = NULL;
+static int saved_stdout = -1;
+static char result_directory[STORE_PATH_SIZE];
+static char result_name[64];
+static char result_prefix[64];
+
+static unsigned long fnv1a(unsigned long hash, const void *data, size_t size) {
+  const unsigned char *bytes = data;
+  size_t i;
+
+  for(i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * FNV_PRIME;
+  }
+
+  return hash;
+}
+
+/* Returns 0 when the file cannot be read */
+static int hash_file(const char *filename, unsigned long *hash) {
+  static char buf[STORE_CHUNK];
+  FILE *file;
+  size_t n;
+
+  if((file = fopen(filename, "rb")) == NULL) {
+    return 0;
+  }
+
+  *hash = FNV_OFFSET_BASIS;
+
+  while((n = fread(buf, 1, sizeof buf, file)) > 0) {
+    *hash = fnv1a(*hash, buf, n);
+  }
+
+  fclose(file);
+  return 1;
+}
+
+static void copy_file(FILE *from, FILE *to) {
+  static char buf[STORE_CHUNK];
+  size_t n;
+
+  while((n = fread(buf, 1, sizeof buf, from)) > 0) {
+    fwrite(buf, 1, n, to);
+  }
+}
+
+/* Stops capturing and writes what was captured to the real stdout, also
+   when the run exits early */
+static void restore_stdout() {
+  if(saved_stdout < 0) {
+    return;
+  }
+
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+  saved_stdout = -1;
+
+  rewind(captured);
+  copy_file(captured, stdout);
+  fflush(stdout);
+  fclose(captured);
+}
+
+/* Removes the results other builds of this simulator stored for the same
+   trace and configuration */
+static void remove_stale_results() {
+  char path[2 * STORE_PATH_SIZE];
+  struct dirent *entry;
+  DIR *directory;
+
+  if((directory = opendir(result_directory)) == NULL) {
+    return;
+  }
+
+  while((entry = readdir(directory)) != NULL) {
+    /* Results still being written by other runs have a suffix */
+    if(strncmp(entry->d_name, result_prefix, strlen(result_prefix)) == 0 && strcmp(entry->d_name, result_name) != 0 &&
+       strchr(entry->d_name, '.') == NULL) {
+      snprintf(path, sizeof path, "%s/%s", result_directory, entry->d_name);
+      unlink(path);
+    }
+  }
+
+  closedir(directory);
+}
+
+int results_store_open(const char *trace, const char *program, const void *config, size_t size) {
+  static int registered = 0;
+  const char *directory = getenv(RESULTS_STORE_ENV);
+  unsigned long trace_hash, config_hash, build_hash;
+  char path[2 * STORE_PATH_SIZE];
+  FILE *result;
+
+  if(directory == NULL || directory[0] == '\0' || strlen(directory) >= STORE_PATH_SIZE ||
+     hash_file(trace, &trace_hash) == 0 || hash_file("/proc/self/exe", &build_hash) == 0) {
+    return 0;
+  }
+
+  /* The program name tells apart simulators built from the same source */
+  program = (strrchr(program, '/') != NULL) ? (strrchr(program, '/') + 1) : program;
+  config_hash = fnv1a(fnv1a(FNV_OFFSET_BASIS, program, strlen(program) + 1), config, size);
+
+  strcpy(result_directory, directory);
+  snprintf(result_prefix, sizeof result_prefix, "%016lx-%016lx-", trace_hash, config_hash);
+  snprintf(result_name, sizeof result_name, "%016lx-%016lx-%016lx", trace_hash, config_hash, build_hash);
+  snprintf(path, sizeof path, "%s/%s", result_directory, result_name);
+
+  if((result = fopen(path, "r")) != NULL) {
+    copy_file(result, stdout);
+    fclose(result);
+    return 1;
+  }
+
+  mkdir(result_directory, 0755);
+  fflush(stdout);
+
+  if((captured = tmpfile()) == NULL) {
+    return 0;
+  }
+
+  if((saved_stdout = dup(STDOUT_FILENO)) < 0 || dup2(fileno(captured), STDOUT_FILENO) < 0) {
+    if(saved_stdout >= 0) {
+      close(saved_stdout);
+      saved_stdout = -1;
+    }
+
+    fclose(captured);
+    return 0;
+  }
+
+  if(registered == 0) {
+    atexit(restore_stdout);
+    registered = 1;
+  }
+
+  return 0;
+}
+
+void results_store_close() {
+  char path[2 * STORE_PATH_SIZE], temporary[2 * STORE_PATH_SIZE + 16];
+  FILE *result;
+
+  if(saved_stdout < 0) {
+    return;
+  }
+
+  fflush(stdout);
+  rewind(captured);
+
+  /* Written aside and renamed, so concurrent runs never read half a result */
+  snprintf(path, sizeof path, "%s/%s", result_directory, result_name);
+  snprintf(temporary, sizeof temporary, "%s.%d", path, (int) getpid());
+
+  if((result = fopen(temporary, "w")) != NULL) {
+    copy_file(captured, result);
+
+    if(fclose(result) == 0 && rename(temporary, path) == 0) {
+      remove_stale_results();
+    } else {
+      unlink(temporary);
+    }
+  }
+
+  restore_stdout();
+}
@@ -0,0 +1,41 @@
+/*
+ * Simulation Results Store
+ *
+ * Copyright (C) 2016  Mateus Ravedutti Lucio Machado
+ *                     Rafael Ravedutti Lucio Machado
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RESULTS_STORE_H
+#define RESULTS_STORE_H
+
+#include <stddef.h>
+
+/* Directory holding the stored results, nothing is memoized when unset */
+#define RESULTS_STORE_ENV    "HPCA_RESULTS_DIR"
+
+/* Looks the run up by trace contents, simulator binary and configuration.
+   The configuration is a struct of the resolved options, cleared before
+   it is filled so that the same run always hashes the same whatever way
+   its options were spelled. On a hit the stored output is written to
+   stdout and 1 is returned. On a miss stdout is captured until
+   results_store_close() */
+int results_store_open(const char *trace, const char *program, const void *config, size_t size);
+
+/* Saves the captured output of a completed run and writes it to stdout */
+void results_store_close();
+
+#endif
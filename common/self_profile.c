@@ -0,0 +1,236 @@
+/*
+ * Simulator Self-Profiling
+ *
+ * Copyright (C) 2016  Mateus Ravedutti Lucio Machado
+ *                     Rafael Ravedutti Lucio Machado
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "self_profile.h"
+
+#ifdef __linux__
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#  include <linux/perf_event.h>
+#endif
+
+/* Phase switches read the time stamp counter where there is one, the
+   monotonic clock otherwise. Ticks are converted to seconds with the wall
+   clock time of the whole run */
+#if defined(__x86_64__) || defined(__i386__)
+#  include <x86intrin.h>
+#  define TIMESTAMP()           __rdtsc()
+#else
+#  define TIMESTAMP()           monotonic_ns()
+#endif
+
+/* Host counters, read for the whole run */
+#define HOST_CYCLES             0
+#define HOST_INSTRUCTIONS       1
+#define HOST_LLC_MISSES         2
+#define HOST_BRANCH_MISSES      3
+#define HOST_COUNTERS           4
+
+/* Switches timed to estimate what the profiler itself costs */
+#define CALIBRATION_SWITCHES    4096
+
+int self_profiling = 0;
+int self_profile_active = 0;
+
+static unsigned long long ticks[SELF_PHASES];
+static unsigned long long last_tick, start_ns;
+static unsigned long long switches = 0, record_count = 0;
+static double switch_ticks = 0.0;
+static unsigned int stack[SELF_PROFILE_DEPTH], depth = 0, current = SELF_OTHER;
+static int counters[HOST_COUNTERS] = { -1, -1, -1, -1 };
+static const char *counters_error = "not supported on this host";
+
+static unsigned long long monotonic_ns() {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* Measures the ticks one switch adds */
+static void calibrate() {
+  unsigned long long start;
+  unsigned int i;
+
+  last_tick = start = TIMESTAMP();
+
+  for(i = 0; i < CALIBRATION_SWITCHES; ++i) {
+    self_profile_switch(SELF_OTHER);
+  }
+
+  switch_ticks = (double) (TIMESTAMP() - start) / CALIBRATION_SWITCHES;
+  memset(ticks, 0, sizeof ticks);
+  switches = 0;
+}
+
+static void open_host_counters() {
+#ifdef __linux__
+  static const unsigned long long configs[HOST_COUNTERS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                             PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+  struct perf_event_attr attr;
+  unsigned int i;
+
+  for(i = 0; i < HOST_COUNTERS; ++i) {
+    memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[i];
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    if((counters[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0)) < 0) {
+      counters_error = strerror(errno);
+
+      /* All or nothing, partial counts are hard to read */
+      while(i-- > 0) {
+        close(counters[i]);
+        counters[i] = -1;
+      }
+
+      return;
+    }
+  }
+
+  for(i = 0; i < HOST_COUNTERS; ++i) {
+    ioctl(counters[i], PERF_EVENT_IOC_RESET, 0);
+    ioctl(counters[i], PERF_EVENT_IOC_ENABLE, 0);
+  }
+#endif
+}
+
+void self_profile_init() {
+  const char *enabled = getenv(SELF_PROFILE_ENV);
+
+  if(enabled == NULL || enabled[0] == '\0') {
+    return;
+  }
+
+  self_profiling = 1;
+  calibrate();
+  open_host_counters();
+
+  /* The first batch is sampled */
+  start_ns = monotonic_ns();
+  self_profile_active = 1;
+  last_tick = TIMESTAMP();
+}
+
+void self_profile_switch(unsigned int phase) {
+  unsigned long long now = TIMESTAMP();
+
+  ticks[current] += now - last_tick;
+  last_tick = now;
+  current = phase;
+  ++switches;
+}
+
+void self_profile_record() {
+  int active;
+
+  if(++record_count % SELF_PROFILE_BATCH == 0) {
+    active = ((record_count / SELF_PROFILE_BATCH) % SELF_PROFILE_SAMPLE) == 0;
+
+    if(active != self_profile_active) {
+      if(active) {
+        last_tick = TIMESTAMP();
+      } else {
+        self_profile_switch(current);
+      }
+
+      self_profile_active = active;
+      current = SELF_OTHER;
+    }
+  }
+
+  if(self_profile_active) {
+    self_profile_switch(SELF_OTHER);
+  }
+}
+
+void self_profile_enter(unsigned int phase) {
+  if(depth < SELF_PROFILE_DEPTH) {
+    stack[depth] = current;
+  }
+
+  ++depth;
+  self_profile_switch(phase);
+}
+
+void self_profile_leave() {
+  --depth;
+  self_profile_switch((depth < SELF_PROFILE_DEPTH) ? stack[depth] : current);
+}
+
+void self_profile_report(unsigned long records) {
+  static const char *names[SELF_PHASES] = { "Other", "Parse", "L1 Lookup", "L2 Lookup", "Fill/Replace", "Prefetcher", "Predictor" };
+  unsigned long long values[HOST_COUNTERS], total = 0;
+  double seconds;
+  unsigned int i;
+
+  if(self_profiling == 0) {
+    return;
+  }
+
+  if(self_profile_active) {
+    self_profile_switch(current);
+  }
+
+  seconds = (monotonic_ns() - start_ns) / 1e9;
+
+  /* Phase times are the sampled shares of the whole run */
+  for(i = 0; i < SELF_PHASES; ++i) {
+    total += ticks[i];
+  }
+
+  total = (total > 0) ? total : 1;
+
+  fprintf(stderr, "Self Profile Records: %lu\n", records);
+  fprintf(stderr, "Self Profile Time: %.3f s\n", seconds);
+  fprintf(stderr, "Self Profile Records/s: %.0f\n", (seconds > 0) ? (records / seconds) : 0.0);
+  fprintf(stderr, "Self Profile Sampling: 1 of every %u batches of %u records\n", SELF_PROFILE_SAMPLE, SELF_PROFILE_BATCH);
+  fprintf(stderr, "Self Profile Overhead: %.1f%% of sampled time (%llu switches)\n", 100.0 * switches * switch_ticks / total, switches);
+
+  for(i = 0; i < SELF_PHASES; ++i) {
+    if(ticks[i] > 0) {
+      fprintf(stderr, "Self Profile %s: %.1f%% (%.3f s)\n", names[i], 100.0 * ticks[i] / total, seconds * ticks[i] / total);
+    }
+  }
+
+  for(i = 0; i < HOST_COUNTERS; ++i) {
+    if(counters[i] < 0 || read(counters[i], &values[i], sizeof values[i]) != sizeof values[i]) {
+      fprintf(stderr, "Host Counters: unavailable (%s)\n", counters_error);
+      return;
+    }
+  }
+
+  fprintf(stderr, "Host Cycles/Instructions/LLC Misses/Branch Misses: %llu/%llu/%llu/%llu\n",
+          values[HOST_CYCLES], values[HOST_INSTRUCTIONS], values[HOST_LLC_MISSES], values[HOST_BRANCH_MISSES]);
+  fprintf(stderr, "Host IPC: %.3f\n", (values[HOST_CYCLES] > 0) ? ((double) values[HOST_INSTRUCTIONS] / values[HOST_CYCLES]) : 0.0);
+  fprintf(stderr, "Host Instructions/Record: %.1f\n", (records > 0) ? ((double) values[HOST_INSTRUCTIONS] / records) : 0.0);
+}
@@ -0,0 +1,66 @@
+/*
+ * Simulator Self-Profiling
+ *
+ * Copyright (C) 2016  Mateus Ravedutti Lucio Machado
+ *                     Rafael Ravedutti Lucio Machado
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SELF_PROFILE_H
+#define SELF_PROFILE_H
+
+/* Profiling is enabled by setting this variable to a non-empty value */
+#define SELF_PROFILE_ENV        "HPCA_SELF_PROFILE"
+
+/* Simulator phases, time not spent in any other phase goes to SELF_OTHER */
+#define SELF_OTHER              0
+#define SELF_PARSE              1
+#define SELF_L1                 2
+#define SELF_L2                 3
+#define SELF_FILL               4
+#define SELF_PREFETCHER         5
+#define SELF_PREDICTOR          6
+#define SELF_PHASES             7
+
+#define SELF_PROFILE_DEPTH      16
+
+/* Phases are timed for one batch of records in every SELF_PROFILE_SAMPLE,
+   so the time stamp reads at every switch cost little overall */
+#define SELF_PROFILE_BATCH      1024
+#define SELF_PROFILE_SAMPLE     16
+
+extern int self_profiling;
+extern int self_profile_active; /* Within a sampled batch */
+
+void self_profile_init();
+void self_profile_enter(unsigned int phase);
+void self_profile_leave();
+void self_profile_switch(unsigned int phase);
+
+/* Called at the start of every record, switches to SELF_OTHER */
+void self_profile_record();
+
+/* Prints the breakdown to stderr, so it never ends up in stored results */
+void self_profile_report(unsigned long records);
+
+/* Phases nest, time is charged to the innermost one. Batches only start
+   at a record, outside of any phase */
+#define SELF_PROFILE_ENTER(phase)   do { if(self_profile_active) self_profile_enter(phase); } while(0)
+#define SELF_PROFILE_LEAVE()        do { if(self_profile_active) self_profile_leave(); } while(0)
+#define SELF_PROFILE_SWITCH(phase)  do { if(self_profile_active) self_profile_switch(phase); } while(0)
+#define SELF_PROFILE_RECORD()       do { if(self_profiling) self_profile_record(); } while(0)
+
+#endif
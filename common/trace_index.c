@@ -0,0 +1,214 @@
+/*
+ * Trace Sidecar Index
+ *
+ * Copyright (C) 2016  Mateus Ravedutti Lucio Machado
+ *                     Rafael Ravedutti Lucio Machado
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "trace_index.h"
+
+#define INDEX_PATH_SIZE      4096
+#define INDEX_GROWTH         1024 /* Entries */
+
+static void index_path(const char *trace, char *path) {
+  snprintf(path, INDEX_PATH_SIZE, "%s%s", trace, TRACE_INDEX_SUFFIX);
+}
+
+static void add_entry(struct trace_index *index, unsigned long offset, unsigned long record) {
+  if(index->header.entries % INDEX_GROWTH == 0) {
+    index->entries = realloc(index->entries, (index->header.entries + INDEX_GROWTH) * sizeof(struct trace_index_entry));
+
+    if(index->entries == NULL) {
+      fprintf(stderr, "Could not allocate trace index.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  index->entries[index->header.entries].offset = offset;
+  index->entries[index->header.entries].record = record;
+  ++index->header.entries;
+}
+
+/* Counts the opcode of a record, opcodes beyond the table share its last slot */
+static void count_opcode(struct trace_index *index, const char *opcode, size_t length) {
+  unsigned int i;
+
+  if(length >= TRACE_INDEX_OPCODE_SIZE) {
+    length = TRACE_INDEX_OPCODE_SIZE - 1;
+  }
+
+  for(i = 0; i < index->header.opcodes; ++i) {
+    if(strncmp(index->header.opcode_names[i], opcode, length) == 0 && index->header.opcode_names[i][length] == '\0') {
+      ++index->header.opcode_counts[i];
+      return;
+    }
+  }
+
+  if(i == TRACE_INDEX_OPCODES) {
+    strcpy(index->header.opcode_names[i - 1], "Other");
+    ++index->header.opcode_counts[i - 1];
+    return;
+  }
+
+  memcpy(index->header.opcode_names[i], opcode, length);
+  index->header.opcode_names[i][length] = '\0';
+  index->header.opcode_counts[i] = 1;
+  ++index->header.opcodes;
+}
+
+static void build_index(const char *trace, unsigned int opcode_field, unsigned int address_fields, struct trace_index *index) {
+  char *line = NULL, *field, *end;
+  size_t size = 0;
+  unsigned long offset = 0, address;
+  unsigned int i;
+  ssize_t length;
+  FILE *file;
+
+  if((file = fopen(trace, "r")) == NULL) {
+    fprintf(stderr, "Could not open file.\n");
+    exit(1);
+  }
+
+  index->header.min_address = ~0UL;
+  index->header.max_address = 0;
+
+  while((length = getline(&line, &size, file)) > 0) {
+    if(index->header.records % TRACE_INDEX_INTERVAL == 0) {
+      add_entry(index, offset, index->header.records);
+    }
+
+    for(i = 0, field = line; field != NULL; ++i, field = (end != NULL) ? (end + 1) : NULL) {
+      end = strchr(field, ';');
+
+      if(i == opcode_field) {
+        count_opcode(index, field, (end != NULL) ? (size_t) (end - field) : strcspn(field, "\n"));
+      }
+
+      if((address_fields & (1U << i)) && (address = strtoul(field, NULL, 10)) != 0) {
+        index->header.min_address = (address < index->header.min_address) ? address : index->header.min_address;
+        index->header.max_address = (address > index->header.max_address) ? address : index->header.max_address;
+      }
+    }
+
+    offset += length;
+    ++index->header.records;
+  }
+
+  free(line);
+  fclose(file);
+}
+
+void trace_index_load(const char *trace, unsigned int opcode_field, unsigned int address_fields, struct trace_index *index) {
+  char path[INDEX_PATH_SIZE], temporary[INDEX_PATH_SIZE + 16];
+  struct stat trace_stat;
+  FILE *file;
+
+  if(stat(trace, &trace_stat) != 0) {
+    fprintf(stderr, "Could not open file.\n");
+    exit(1);
+  }
+
+  index_path(trace, path);
+  index->entries = NULL;
+
+  if((file = fopen(path, "rb")) != NULL) {
+    if(fread(&index->header, sizeof index->header, 1, file) == 1 &&
+       memcmp(index->header.magic, TRACE_INDEX_MAGIC, sizeof index->header.magic) == 0 &&
+       index->header.interval == TRACE_INDEX_INTERVAL && index->header.trace_size == (unsigned long) trace_stat.st_size &&
+       index->header.trace_mtime == (long) trace_stat.st_mtime &&
+       (index->entries = malloc((index->header.entries + 1) * sizeof(struct trace_index_entry))) != NULL &&
+       fread(index->entries, sizeof(struct trace_index_entry), index->header.entries, file) == index->header.entries) {
+      fclose(file);
+      return;
+    }
+
+    free(index->entries);
+    index->entries = NULL;
+    fclose(file);
+  }
+
+  /* Missing or stale, index the trace again */
+  memset(&index->header, 0, sizeof index->header);
+  memcpy(index->header.magic, TRACE_INDEX_MAGIC, sizeof index->header.magic);
+  index->header.interval = TRACE_INDEX_INTERVAL;
+  index->header.trace_size = trace_stat.st_size;
+  index->header.trace_mtime = trace_stat.st_mtime;
+
+  build_index(trace, opcode_field, address_fields, index);
+
+  /* Written aside and renamed, a trace in a read-only place is indexed every run */
+  snprintf(temporary, sizeof temporary, "%s.%d", path, (int) getpid());
+
+  if((file = fopen(temporary, "wb")) != NULL) {
+    if(fwrite(&index->header, sizeof index->header, 1, file) != 1 ||
+       fwrite(index->entries, sizeof(struct trace_index_entry), index->header.entries, file) != index->header.entries ||
+       fclose(file) != 0 || rename(temporary, path) != 0) {
+      unlink(temporary);
+    }
+  }
+}
+
+FILE *trace_index_open(const char *trace, const struct trace_index *index, unsigned long record) {
+  char *line = NULL;
+  size_t size = 0;
+  unsigned long i;
+  FILE *file;
+
+  if((file = fopen(trace, "r")) == NULL) {
+    fprintf(stderr, "Could not open file.\n");
+    exit(1);
+  }
+
+  if(record >= index->header.records) {
+    fseek(file, 0, SEEK_END);
+    return file;
+  }
+
+  /* Entries are evenly spaced, so the closest one before record is direct */
+  i = record / index->header.interval;
+  fseek(file, index->entries[i].offset, SEEK_SET);
+
+  for(i = index->entries[i].record; i < record; ++i) {
+    if(getline(&line, &size, file) < 0) {
+      break;
+    }
+  }
+
+  free(line);
+  return file;
+}
+
+void trace_index_print(const struct trace_index *index) {
+  unsigned int i;
+
+  fprintf(stdout, "Trace Records: %lu\n", index->header.records);
+  fprintf(stdout, "Trace Index Entries: %lu (every %u records)\n", index->header.entries, index->header.interval);
+
+  if(index->header.max_address > 0) {
+    fprintf(stdout, "Trace Address Range: %lu-%lu\n", index->header.min_address, index->header.max_address);
+  }
+
+  for(i = 0; i < index->header.opcodes; ++i) {
+    fprintf(stdout, "Opcode %s: %lu\n", index->header.opcode_names[i], index->header.opcode_counts[i]);
+  }
+}
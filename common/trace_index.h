@@ -0,0 +1,69 @@
+/*
+ * Trace Sidecar Index
+ *
+ * Copyright (C) 2016  Mateus Ravedutti Lucio Machado
+ *                     Rafael Ravedutti Lucio Machado
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef TRACE_INDEX_H
+#define TRACE_INDEX_H
+
+#include <stdio.h>
+
+/* The index of trace.txt is stored next to it as trace.txt.idx */
+#define TRACE_INDEX_SUFFIX        ".idx"
+#define TRACE_INDEX_MAGIC         "TIDX"
+#define TRACE_INDEX_INTERVAL      4096 /* Records between index entries */
+#define TRACE_INDEX_OPCODES       32   /* Distinct opcodes kept in the mix */
+#define TRACE_INDEX_OPCODE_SIZE   20
+
+struct trace_index_header {
+  char magic[4];
+  unsigned int interval;
+  unsigned long trace_size;  /* Size and modification time of the indexed trace */
+  long trace_mtime;
+  unsigned long records;
+  unsigned long entries;
+  unsigned long min_address;
+  unsigned long max_address;
+  unsigned int opcodes;
+  char opcode_names[TRACE_INDEX_OPCODES][TRACE_INDEX_OPCODE_SIZE];
+  unsigned long opcode_counts[TRACE_INDEX_OPCODES];
+} __attribute__((packed));
+
+/* Record number record starts at byte offset */
+struct trace_index_entry {
+  unsigned long offset;
+  unsigned long record;
+};
+
+struct trace_index {
+  struct trace_index_header header;
+  struct trace_index_entry *entries;
+};
+
+/* Loads the index of trace, building it when it is missing or older than
+   the trace. Fields of the semicolon separated records are counted from 0,
+   bit i of address_fields is set when field i holds an address */
+void trace_index_load(const char *trace, unsigned int opcode_field, unsigned int address_fields, struct trace_index *index);
+
+/* Opens trace positioned at the start of record */
+FILE *trace_index_open(const char *trace, const struct trace_index *index, unsigned long record);
+
+void trace_index_print(const struct trace_index *index);
+
+#endif